@@ -0,0 +1,98 @@
+// Heap allocations per validate() call, with one scratch arena reused
+// across calls as tvv batch and the server do. build.sh builds it as
+// build/tvv-alloc-bench:
+//
+//   tvv-alloc-bench <instance.json> <submission.json> [runs]
+//
+// Every replaceable operator new is counted, so allocations made by the
+// standard library and by nlohmann::json are included.
+#include "validator.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <string>
+
+static std::atomic<size_t> g_allocations{0};
+
+static void* counted(size_t n, size_t align) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (n == 0) n = 1;
+  void* p = align > alignof(std::max_align_t)
+    ? std::aligned_alloc(align, (n + align - 1) / align * align)
+    : std::malloc(n);
+  return p;
+}
+
+void* operator new(size_t n) {
+  if (void* p = counted(n, 0)) return p;
+  throw std::bad_alloc();
+}
+void* operator new(size_t n, std::align_val_t a) {
+  if (void* p = counted(n, (size_t)a)) return p;
+  throw std::bad_alloc();
+}
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return counted(n, 0); }
+void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return counted(n, (size_t)a); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+static bool read_file(const char* path, std::string& out) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  std::ostringstream ss;
+  ss << f.rdbuf();
+  out = ss.str();
+  return true;
+}
+
+// Allocations of the last of `runs` calls of `fn`; the earlier ones let
+// the arena grow to its high-water mark.
+static size_t steady_allocations(int runs, const std::function<void()>& fn) {
+  size_t n = 0;
+  for (int i = 0; i < runs; ++i) {
+    const size_t before = g_allocations.load();
+    fn();
+    n = g_allocations.load() - before;
+  }
+  return n;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::fprintf(stderr, "usage: tvv-alloc-bench <instance.json> <submission.json> [runs]\n");
+    return 2;
+  }
+  std::string instance, submission;
+  if (!read_file(argv[1], instance) || !read_file(argv[2], submission)) {
+    std::fprintf(stderr, "tvv-alloc-bench: cannot read input files\n");
+    return 1;
+  }
+  const int runs = argc > 3 ? std::max(2, std::atoi(argv[3])) : 5;
+
+  tvv::ScratchArena arena;
+  tvv::ValidateOptions opts;
+  opts.arena = &arena;
+  std::string status;
+
+  const size_t one_shot = steady_allocations(runs, [&] {
+    status = tvv::validate(instance, submission, opts).status;
+    arena.reset();
+  });
+  auto prepared = tvv::prepare_instance(instance);
+  const size_t reuse = steady_allocations(runs, [&] {
+    tvv::validate(*prepared, submission, opts);
+    arena.reset();
+  });
+
+  std::printf("status %s, arena %zu bytes\n", status.c_str(), arena.capacity());
+  std::printf("validate(instance, submission): %zu allocations per call\n", one_shot);
+  std::printf("validate(prepared, submission): %zu allocations per call\n", reuse);
+  return 0;
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Native builds: the `tvv` binary (one-shot validation and the socket
+# server) and libtvv.so exposing the C interface in validator/inc/tvv.h.
+CXX="${CXX:-g++}"
+CXXFLAGS="-O3 -std=c++17 -pthread -I ../validator/inc"
+LIB_SOURCES=(
+  ../validator/src/validator.cc
+  ../validator/src/rules.cc
+  ../validator/src/schema.cc
+  ../validator/src/scratch.cc
+  ../validator/src/thread_pool.cc
+  ../validator/src/result_cache.cc
+  ../validator/src/stream.cc
+  ../validator/src/capi.cc
+  ../validator/src/mapped_file.cc
+  ../validator/src/compiled_instance.cc
+  ../validator/src/trace.cc
+)
+mkdir -p build
+
+"$CXX" $CXXFLAGS -fPIC -shared -fvisibility=hidden \
+  "${LIB_SOURCES[@]}" \
+  -o build/libtvv.so
+
+"$CXX" $CXXFLAGS \
+  "${LIB_SOURCES[@]}" \
+  ../validator/src/server.cc \
+  ../validator/src/tvv_main.cc \
+  -o build/tvv
+
+# Heap allocations per validate() call; see alloc_bench.cc.
+"$CXX" $CXXFLAGS \
+  "${LIB_SOURCES[@]}" \
+  alloc_bench.cc \
+  -o build/tvv-alloc-bench
+
+echo "Built native/build/tvv, native/build/tvv-alloc-bench and native/build/libtvv.so"
@@ -0,0 +1,96 @@
+// Decoder for the columnar result encoding produced by `to_binary` in
+// validator/src/validator.cc (see the layout comment in validator.hh).
+// Arrays are typed-array views over the given bytes; nothing is parsed.
+
+const STATUS = ["VALID", "INVALID", "ERROR", "PRUNED", "TIMEOUT", "CANCELLED"] as const;
+const NO_STRING = 0xffffffff;
+
+export interface BinaryResult {
+  status: (typeof STATUS)[number];
+  score: {
+    total: number;
+    base: number;
+    bonuses: number;
+    switches: { count: number; S: number; total: number };
+    early_late: { early: number; late: number; T: number; total: number };
+  };
+  validator_version: string;
+  error_message?: string;
+  items: {
+    start: Int32Array;
+    end: Int32Array;
+    channel: Int32Array;
+    program: Int32Array;         // string index of the program id
+    programOrdinal: Int32Array;  // catalog ordinal, -1 if unknown
+    genre: Int32Array;           // string index, -1 if none
+    valid: Uint8Array;
+  };
+  violations: {
+    code: Int32Array;            // string index
+    item: Int32Array;            // timeline index, -1 if none
+    t: Int32Array;
+    message: Int32Array;         // string index
+  };
+  string: (index: number) => string;
+}
+
+export function decodeBinaryResult(bytes: Uint8Array): BinaryResult {
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  if (view.getUint32(0, true) !== 0x42565654) throw new Error("Not a TVVB result");
+  const version = view.getUint32(4, true);
+  if (version !== 1) throw new Error(`Unsupported TVVB version ${version}`);
+
+  const score = Array.from({ length: 10 }, (_, i) => view.getInt32(12 + 4 * i, true));
+  const n = view.getUint32(52, true);
+  const m = view.getUint32(56, true);
+  const stringCount = view.getUint32(60, true);
+  const versionString = view.getUint32(64, true);
+  const errorString = view.getUint32(68, true);
+
+  // Int32Array views need 4-byte alignment; sections are aligned relative
+  // to the start of the result, so copy once if the result itself is not.
+  let base = bytes;
+  if (bytes.byteOffset % 4 !== 0) base = bytes.slice();
+  let offset = 72;
+  const ints = (count: number) => {
+    const a = new Int32Array(base.buffer, base.byteOffset + offset, count);
+    offset += 4 * count;
+    return a;
+  };
+
+  const start = ints(n), end = ints(n), channel = ints(n);
+  const program = ints(n), programOrdinal = ints(n), genre = ints(n);
+  const valid = new Uint8Array(base.buffer, base.byteOffset + offset, n);
+  offset = (offset + n + 3) & ~3;
+
+  const code = ints(m), item = ints(m), t = ints(m), message = ints(m);
+
+  const stringOffsets = new Uint32Array(base.buffer, base.byteOffset + offset, stringCount + 1);
+  const stringBase = offset + 4 * (stringCount + 1);
+  const decoder = new TextDecoder();
+  const cache = new Map<number, string>();
+  const string = (index: number) => {
+    let s = cache.get(index);
+    if (s === undefined) {
+      s = decoder.decode(base.subarray(stringBase + stringOffsets[index], stringBase + stringOffsets[index + 1]));
+      cache.set(index, s);
+    }
+    return s;
+  };
+
+  return {
+    status: STATUS[view.getUint32(8, true)] ?? "ERROR",
+    score: {
+      total: score[0],
+      base: score[1],
+      bonuses: score[2],
+      switches: { count: score[3], S: score[4], total: score[5] },
+      early_late: { early: score[6], late: score[7], T: score[8], total: score[9] },
+    },
+    validator_version: string(versionString),
+    error_message: errorString === NO_STRING ? undefined : string(errorString),
+    items: { start, end, channel, program, programOrdinal, genre, valid },
+    violations: { code, item, t, message },
+    string,
+  };
+}
@@ -1,3 +1,5 @@
+import { BinaryResult, decodeBinaryResult } from "./resultBinary";
+
 let modulePromise: Promise<any> | null = null;
 
 function loadScriptOnce(src: string): Promise<void> {
@@ -28,6 +30,60 @@ export async function initValidator() {
   return { mod, validate_ptr, free_buffer };
 }
 
+/**
+ * Limits each later validation to `ms` milliseconds (0 = unlimited). A
+ * validation over budget returns status "TIMEOUT" with the phase it reached
+ * and the violations found so far. Older builds ignore the budget.
+ */
+export async function setValidationTimeBudget(ms: number) {
+  const { mod } = await initValidator();
+  if (typeof mod._set_time_budget === "function") mod._set_time_budget(Math.max(0, Math.floor(ms)));
+}
+
+/**
+ * Makes later ERROR results list every structural, type and reference
+ * error as `errors: [{ path, message }]`, with `path` a JSON Pointer into
+ * the instance or submission. Older builds ignore it.
+ */
+export async function setCollectAllErrors(on: boolean) {
+  const { mod } = await initValidator();
+  if (typeof mod._set_all_errors === "function") mod._set_all_errors(on ? 1 : 0);
+}
+
+const encoder = new TextEncoder();
+const decoder = new TextDecoder();
+
+// Copies `text` into a fresh WASM heap buffer; the caller frees it.
+function writeToHeap(mod: any, text: string): { ptr: number; len: number } {
+  const bytes = encoder.encode(text);
+  const ptr = mod._malloc(Math.max(bytes.length, 1));
+  if (!ptr) throw new Error("WASM: out of memory");
+  mod.HEAPU8.set(bytes, ptr);
+  return { ptr, len: bytes.length };
+}
+
+// Builds exporting validate_buffers parse the inputs in place and lend the
+// result back as ptr/len, avoiding the string marshalling of cwrap.
+function validateWithBuffers(mod: any, instanceText: string, submissionText: string, verbose: boolean) {
+  const ins = writeToHeap(mod, instanceText);
+  let sub: { ptr: number; len: number } | null = null;
+  const outLenPtr = mod._malloc(4);
+  try {
+    sub = writeToHeap(mod, submissionText);
+    const resultPtr = mod._validate_buffers(ins.ptr, ins.len, sub.ptr, sub.len, verbose ? 1 : 0, outLenPtr);
+    if (!resultPtr) throw new Error("WASM: validate_buffers returned null pointer");
+    const len = mod.getValue(outLenPtr, "i32") >>> 0;
+    // HEAPU8 may have been replaced by memory growth during the call.
+    const jsonStr = decoder.decode(mod.HEAPU8.subarray(resultPtr, resultPtr + len));
+    mod._free_result(resultPtr);
+    return JSON.parse(jsonStr);
+  } finally {
+    mod._free(ins.ptr);
+    if (sub) mod._free(sub.ptr);
+    mod._free(outLenPtr);
+  }
+}
+
 export async function validateWithWasm(
   instanceText: string,
   submissionText: string,
@@ -35,6 +91,10 @@ export async function validateWithWasm(
 ) {
   const { mod } = await initValidator();
 
+  if (typeof mod._validate_buffers === "function" && mod.HEAPU8) {
+    return validateWithBuffers(mod, instanceText, submissionText, verbose);
+  }
+
   const validate = mod.cwrap(
     "validate_json",
     "number",
@@ -71,3 +131,98 @@ export async function validateWithWasm(
   // Parse JSON result
   return JSON.parse(jsonStr);
 }
+
+/**
+ * Validates and returns the columnar result (see resultBinary.ts), whose
+ * timeline and violations are typed arrays rather than parsed objects.
+ * The bytes are copied out of WASM memory once, since memory growth in a
+ * later call would detach views into it.
+ */
+export async function validateWithWasmBinary(
+  instanceText: string,
+  submissionText: string,
+  verbose: boolean
+): Promise<BinaryResult> {
+  const { mod } = await initValidator();
+  if (typeof mod._validate_binary !== "function" || !mod.HEAPU8) {
+    throw new Error("WASM: this build has no validate_binary export");
+  }
+
+  const ins = writeToHeap(mod, instanceText);
+  let sub: { ptr: number; len: number } | null = null;
+  const outLenPtr = mod._malloc(4);
+  try {
+    sub = writeToHeap(mod, submissionText);
+    const resultPtr = mod._validate_binary(ins.ptr, ins.len, sub.ptr, sub.len, verbose ? 1 : 0, outLenPtr);
+    if (!resultPtr) throw new Error("WASM: validate_binary returned null pointer");
+    const len = mod.getValue(outLenPtr, "i32") >>> 0;
+    const bytes = mod.HEAPU8.slice(resultPtr, resultPtr + len);
+    mod._free_result(resultPtr);
+    return decodeBinaryResult(bytes);
+  } finally {
+    mod._free(ins.ptr);
+    if (sub) mod._free(sub.ptr);
+    mod._free(outLenPtr);
+  }
+}
+
+export interface StreamedViolation {
+  code: string;
+  message: string;
+  t: number;
+  item: number;   // index into the final result's timeline
+}
+
+export interface ValidationEvents {
+  /** Called as each violation is found; return false to stop (status "CANCELLED"). */
+  onViolation?: (v: StreamedViolation) => boolean | void;
+  /** Called as each validation phase starts. */
+  onPhase?: (phase: string) => void;
+}
+
+/**
+ * Validates with violations delivered through `events` as they are found
+ * rather than collected in the result, whose `violations` is then empty.
+ * The call is still synchronous inside WASM: run it in a Worker and post
+ * the events to show them while validation is in progress.
+ */
+export async function validateWithWasmStreaming(
+  instanceText: string,
+  submissionText: string,
+  verbose: boolean,
+  events: ValidationEvents
+) {
+  const { mod } = await initValidator();
+  if (typeof mod._validate_streaming !== "function" || typeof mod.addFunction !== "function") {
+    throw new Error("WASM: this build has no validate_streaming export");
+  }
+
+  const callback = mod.addFunction((ptr: number, len: number) => {
+    const e = JSON.parse(decoder.decode(mod.HEAPU8.subarray(ptr, ptr + len)));
+    if (e.type === "phase") {
+      events.onPhase?.(e.phase);
+      return 1;
+    }
+    const { type, ...v } = e;
+    return events.onViolation?.(v as StreamedViolation) === false ? 0 : 1;
+  }, "iii");
+
+  const ins = writeToHeap(mod, instanceText);
+  let sub: { ptr: number; len: number } | null = null;
+  const outLenPtr = mod._malloc(4);
+  try {
+    sub = writeToHeap(mod, submissionText);
+    const resultPtr = mod._validate_streaming(ins.ptr, ins.len, sub.ptr, sub.len, verbose ? 1 : 0,
+                                              events.onPhase ? 1 : 0, callback, outLenPtr);
+    if (!resultPtr) throw new Error("WASM: validate_streaming returned null pointer");
+    const len = mod.getValue(outLenPtr, "i32") >>> 0;
+    const jsonStr = decoder.decode(mod.HEAPU8.subarray(resultPtr, resultPtr + len));
+    mod._free_result(resultPtr);
+    return JSON.parse(jsonStr);
+  } finally {
+    mod._free(ins.ptr);
+    if (sub) mod._free(sub.ptr);
+    mod._free(outLenPtr);
+    mod.removeFunction(callback);
+  }
+}
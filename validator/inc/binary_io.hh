@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tvv {
+
+// Little-endian writer for to_binary() and compile_instance(); wasm32, x86
+// and arm64 are all little-endian, so values are copied as they are.
+class BinaryWriter {
+public:
+  void u64(std::uint64_t v) { raw(&v, 8); }
+  void u32(std::uint32_t v) { raw(&v, 4); }
+  void i32(std::int32_t v) { raw(&v, 4); }
+  void u8(std::uint8_t v) { out_.push_back(char(v)); }
+  void bytes(std::string_view s) { out_.append(s.data(), s.size()); }
+  void align4() { out_.resize((out_.size() + 3) & ~size_t(3), '\0'); }
+  size_t size() const { return out_.size(); }
+  /// Overwrites 8 bytes at `at`, for fields known only once the rest is written.
+  void patch_u64(size_t at, std::uint64_t v) { std::memcpy(&out_[at], &v, 8); }
+  const std::string& str() const { return out_; }
+  std::string take() { return std::move(out_); }
+
+private:
+  void raw(const void* p, size_t n) { out_.append(static_cast<const char*>(p), n); }
+  std::string out_;
+};
+
+/**
+ * @brief Bounds-checked reader over BinaryWriter output.
+ *
+ * Reads past the end yield zeros and clear ok(), so a caller can read a
+ * whole section and check once. Input need not be aligned.
+ */
+class BinaryReader {
+public:
+  explicit BinaryReader(std::string_view in) : in_(in) {}
+
+  std::uint64_t u64() { std::uint64_t v = 0; raw(&v, 8); return v; }
+  std::uint32_t u32() { std::uint32_t v = 0; raw(&v, 4); return v; }
+  std::int32_t i32() { std::int32_t v = 0; raw(&v, 4); return v; }
+  /// `n` consecutive 4-byte values.
+  template <class T>
+  std::vector<T> array(size_t n) {
+    static_assert(sizeof(T) == 4, "");
+    if (n > remaining() / 4) { ok_ = false; return {}; }
+    std::vector<T> v(n);
+    raw(v.data(), 4 * n);
+    return v;
+  }
+  /// The next `n` bytes, viewed in place.
+  std::string_view bytes(size_t n) {
+    if (n > remaining()) { ok_ = false; return {}; }
+    std::string_view s = in_.substr(pos_, n);
+    pos_ += n;
+    return s;
+  }
+
+  size_t remaining() const { return in_.size() - pos_; }
+  bool ok() const { return ok_; }
+
+private:
+  void raw(void* p, size_t n) {
+    if (n > remaining()) { ok_ = false; return; }
+    std::memcpy(p, in_.data() + pos_, n);
+    pos_ += n;
+  }
+  std::string_view in_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+};
+
+} // namespace tvv
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "validator.hh"
+
+namespace tvv {
+
+/// Leading bytes and format version of compile_instance() output (.tvi).
+inline constexpr char kCompiledInstanceMagic[4] = {'T', 'V', 'V', 'I'};
+inline constexpr std::uint32_t kCompiledInstanceVersion = 1;
+
+/**
+ * @brief Serializes a prepared instance as a compiled instance (.tvi).
+ *
+ * The file holds what prepare_instance() derives from the JSON: the
+ * catalog in CSR form (channels index into one program array, in ordinal
+ * order), priority blocks and time preferences, the input-overlap pairs
+ * and a deduplicated string table. Loading it skips the JSON parse, the
+ * instance checks and the overlap sweep. All fields are little-endian and
+ * 4 bytes wide.
+ *
+ *   header    magic "TVVI", u32 version, u64 checksum (hash_bytes() of every
+ *             byte after it), u64 content_hash (of the source JSON),
+ *             u32 validator_version (string), i32 opening_time,
+ *             closing_time, min_duration, max_same_genre, S, T,
+ *             u32 channels, programs, priority_blocks, allowed_channels
+ *             (total over blocks), time_preferences, overlaps, strings,
+ *             string_bytes
+ *   channels  i32 id[], u32 first_program[channels + 1]
+ *   programs  u32 id[] (string), i32 start[], end[], u32 genre[] (string),
+ *             i32 score[]
+ *   blocks    i32 start[], end[], u32 first_allowed[blocks + 1],
+ *             i32 allowed[allowed_channels]
+ *   prefs     i32 start[], end[], u32 genre[] (string), i32 bonus[]
+ *   overlaps  i32 channel_id[], u32 a[], u32 b[] (program ordinals)
+ *   strings   u32 offset[strings + 1], then string_bytes bytes; each
+ *             string is followed by a NUL
+ *
+ * @param pi A prepared instance whose stages all passed.
+ * @return The encoded bytes; empty when `pi` failed a stage.
+ */
+std::string compile_instance(const PreparedInstance& pi);
+
+/// Whether `bytes` starts like compile_instance() output.
+inline bool is_compiled_instance(std::string_view bytes) {
+  return bytes.size() >= 4 && bytes.compare(0, 4, kCompiledInstanceMagic, 4) == 0;
+}
+
+/**
+ * @brief Rebuilds a prepared instance from compile_instance() output.
+ *
+ * Validating against the result gives the same outcome, and the same
+ * result cache keys, as preparing the source JSON.
+ * @param bytes The compiled instance; not referenced after the call.
+ * @param error Set on failure: bad magic or version, checksum mismatch,
+ * another validator version, or a malformed section.
+ * @return The prepared instance; nullptr on failure.
+ */
+std::shared_ptr<const PreparedInstance> load_compiled_instance(std::string_view bytes,
+                                                               std::string& error);
+
+} // namespace tvv
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string_view>
+
+namespace tvv {
+
+/**
+ * @brief Fast non-cryptographic 64-bit hash of a byte range.
+ *
+ * Eight bytes per multiply-rotate round plus a murmur3 finaliser; meant for
+ * cache keys over documents we produced or trust, not for untrusted input
+ * where collisions could be forced; check those with keyed_hash().
+ */
+inline std::uint64_t hash_bytes(const void* data, size_t len, std::uint64_t seed = 0) {
+  constexpr std::uint64_t k1 = 0x9e3779b97f4a7c15ull;
+  constexpr std::uint64_t k2 = 0xc2b2ae3d27d4eb4full;
+  auto rotl = [](std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  std::uint64_t h = seed ^ (len * k1);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    std::uint64_t w;
+    std::memcpy(&w, p + i, 8);
+    h ^= rotl(w * k2, 31) * k1;
+    h = rotl(h, 27) * 5 + 0x52dce729;
+  }
+  std::uint64_t tail = 0;
+  for (size_t s = 0; i < len; ++i, s += 8) tail |= std::uint64_t(p[i]) << s;
+  h ^= rotl(tail * k2, 31) * k1;
+
+  h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+inline std::uint64_t hash_bytes(std::string_view s, std::uint64_t seed = 0) {
+  return hash_bytes(s.data(), s.size(), seed);
+}
+
+/// Secret 128-bit key of keyed_hash().
+struct HashKey {
+  std::uint64_t k0 = 0, k1 = 0;
+};
+
+/**
+ * @brief SipHash-2-4 of a byte range under a secret key.
+ *
+ * Slower than hash_bytes(), but without the key nobody can construct two
+ * inputs with the same digest, so it verifies cache hits on untrusted
+ * input that hash_bytes() only buckets.
+ */
+inline std::uint64_t keyed_hash(const HashKey& key, const void* data, size_t len) {
+  auto rotl = [](std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+  std::uint64_t v0 = key.k0 ^ 0x736f6d6570736575ull;
+  std::uint64_t v1 = key.k1 ^ 0x646f72616e646f6dull;
+  std::uint64_t v2 = key.k0 ^ 0x6c7967656e657261ull;
+  std::uint64_t v3 = key.k1 ^ 0x7465646279746573ull;
+  auto round = [&] {
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+  };
+  auto absorb = [&](std::uint64_t m) {
+    v3 ^= m;
+    round(); round();
+    v0 ^= m;
+  };
+
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    std::uint64_t w = 0;
+    for (int b = 0; b < 8; ++b) w |= std::uint64_t(p[i + b]) << (8 * b);
+    absorb(w);
+  }
+  std::uint64_t last = std::uint64_t(len) << 56;
+  for (size_t s = 0; i < len; ++i, s += 8) last |= std::uint64_t(p[i]) << s;
+  absorb(last);
+
+  v2 ^= 0xff;
+  round(); round(); round(); round();
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+inline std::uint64_t keyed_hash(const HashKey& key, std::string_view s) {
+  return keyed_hash(key, s.data(), s.size());
+}
+
+/// A random key drawn on first use, the same for the rest of the process.
+inline const HashKey& process_hash_key() {
+  static const HashKey key = [] {
+    std::random_device rd;
+    auto u64 = [&] { return (std::uint64_t(rd()) << 32) ^ rd(); };
+    HashKey k;
+    k.k0 = u64();
+    k.k1 = u64();
+    return k;
+  }();
+  return key;
+}
+
+} // namespace tvv
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "validator.hh"
+
+// POSIX targets map files; elsewhere (Emscripten, Windows) they are read.
+#if !defined(__EMSCRIPTEN__) && (defined(__unix__) || defined(__APPLE__))
+#define TVV_HAVE_MMAP 1
+#else
+#define TVV_HAVE_MMAP 0
+#endif
+
+namespace tvv {
+
+/**
+ * @brief Read-only view of a whole file, memory-mapped where possible.
+ *
+ * Parsing from the mapping skips the copy into a std::string, and processes
+ * validating against the same instance file share its page-cache pages.
+ * Pipes, empty files and platforms without mmap fall back to reading the
+ * file into memory. The file must not be truncated while it is mapped.
+ */
+class MappedFile {
+public:
+  enum class Access {
+    Normal,
+    Sequential,  // read once front to back: ask for aggressive read-ahead
+  };
+
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(MappedFile&& o) noexcept { *this = std::move(o); }
+  MappedFile& operator=(MappedFile&& o) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /**
+   * @brief Maps (or reads) `path`, replacing any previous contents.
+   * @param path File to open.
+   * @param access Expected access pattern, passed to madvise().
+   * @return false if the file cannot be opened or read.
+   */
+  bool open(const std::string& path, Access access = Access::Normal);
+  void close();
+
+  std::string_view data() const {
+    return addr_ ? std::string_view(static_cast<const char*>(addr_), size_) : std::string_view(copy_);
+  }
+  /// Whether data() views a mapping rather than a copy.
+  bool mapped() const { return addr_ != nullptr; }
+
+private:
+  void* addr_ = nullptr;
+  size_t size_ = 0;
+  std::string copy_;
+};
+
+/**
+ * @brief validate() on two files, parsed straight from their mappings.
+ * @param instance_path The scheduling instance: JSON or compiled (.tvi).
+ * @param submission_path The submission JSON file.
+ * @param opts Call options; see ValidateOptions.
+ * @return Result As validate() on the files' text; "ERROR" with
+ * "cannot read <path>" when a file cannot be read, or the loader's error
+ * for a bad compiled instance.
+ */
+Result validate_files(const std::string& instance_path,
+                      const std::string& submission_path,
+                      const ValidateOptions& opts);
+
+/**
+ * @brief prepare_instance() on a file, parsed straight from its mapping.
+ *
+ * A compiled instance (see compile_instance()) is loaded instead of parsed.
+ * @param path The scheduling instance: JSON or compiled (.tvi).
+ * @param error Set when nullptr is returned.
+ * @param pool Optional workers for the per-channel checks.
+ * @return The prepared instance; nullptr when the file cannot be read or
+ * is a bad compiled instance.
+ */
+std::shared_ptr<const PreparedInstance> prepare_instance_file(const std::string& path,
+                                                              std::string& error,
+                                                              ThreadPool* pool = nullptr);
+
+} // namespace tvv
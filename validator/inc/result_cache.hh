@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "hash.hh"
+
+namespace tvv {
+
+/**
+ * @brief Key of a memoized result: hashes of both inputs.
+ *
+ * The submission half is seeded with kValidatorVersion, kResultRevision
+ * and the output flags (verbose, marginals, all_errors), so results from
+ * other rules or modes never match. Those two hash_bytes() values only pick
+ * the slot; `check`, a keyed_hash() of both inputs and the flags, must
+ * match as well, so a crafted collision is a miss, not another submission's
+ * result.
+ */
+struct ResultKey {
+  std::uint64_t instance = 0;
+  std::uint64_t submission = 0;
+  std::uint64_t check = 0;
+
+  bool operator==(const ResultKey& o) const {
+    return instance == o.instance && submission == o.submission && check == o.check;
+  }
+
+  /// `instance_check` is keyed_hash(key, instance text), e.g.
+  /// PreparedInstance::content_check under process_hash_key().
+  static ResultKey of(std::uint64_t instance_hash, std::uint64_t instance_check,
+                      std::string_view submission_json,
+                      bool verbose, bool marginals = false, bool all_errors = false,
+                      const HashKey& key = process_hash_key());
+  static ResultKey of(std::string_view instance_json, std::string_view submission_json,
+                      bool verbose, bool marginals = false, bool all_errors = false,
+                      const HashKey& key = process_hash_key());
+
+  /// 32 hex digits of the slot hashes, e.g. for cache file names; entries
+  /// stored under them must record `check` to compare on read.
+  std::string hex() const;
+};
+
+/**
+ * @brief Thread-safe LRU of serialized results, bounded by total bytes.
+ *
+ * Entries are to_cache_json() output, so a hit reports elapsed_ms 0.
+ */
+class ResultCache {
+public:
+  explicit ResultCache(size_t max_bytes = 64u << 20) : max_bytes_(max_bytes) {}
+
+  /// Copies the cached JSON for `key` into `out`; false on a miss.
+  bool find(const ResultKey& key, std::string& out);
+
+  /// Stores `json`, evicting least recently used entries to stay in budget.
+  void insert(const ResultKey& key, std::string json);
+
+  size_t bytes() const;
+  size_t hits() const;
+  size_t misses() const;
+
+private:
+  struct KeyHash {
+    size_t operator()(const ResultKey& k) const { return size_t(k.instance ^ (k.submission * 31)); }
+  };
+  using Entry = std::pair<ResultKey, std::string>;
+
+  size_t max_bytes_;
+  size_t bytes_ = 0;
+  size_t hits_ = 0, misses_ = 0;
+  mutable std::mutex mu_;
+  std::list<Entry> lru_;   // front = most recently used
+  std::unordered_map<ResultKey, std::list<Entry>::iterator, KeyHash> index_;
+};
+
+} // namespace tvv
@@ -1,33 +1,97 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
+#include "scratch.hh"
+
+// Whether the build has exceptions. Without them (-fno-exceptions, e.g. the
+// WASM build) the core reports every input error by value and the throwing
+// parse_instance()/parse_submission() wrappers are left out.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define TVV_EXCEPTIONS 1
+#else
+#define TVV_EXCEPTIONS 0
+#endif
 
 namespace tvv {
 
+// Ids and genres of a built Instance view strings of its StringPool.
 struct Program {
-  std::string id;
+  std::string_view id;
   int start=0, end=0;
-  std::string genre;
+  std::string_view genre;
   int score=0;
+  int ordinal=-1;   // index into Instance::programs
 };
 
+// Instance containers take scratch_or_default() when built: see Instance.
 struct Channel {
   int id=0;
-  std::vector<Program> programs;
+  std::pmr::vector<Program> programs{scratch_or_default()};
 };
 
 struct PriorityBlock {
   int start=0, end=0;
-  std::vector<int> allowed_channels;
+  std::pmr::vector<int> allowed_channels{scratch_or_default()};
 };
 
 struct TimePreference {
   int start=0, end=0;
-  std::string preferred_genre;
+  std::string_view preferred_genre;
   int bonus=0;
 };
 
+/**
+ * @brief Dense per-minute lookups over [opening_time, closing_time).
+ *
+ * Only filled when the domain is small enough (see build_time_index); the
+ * sparse per-genre preference index is always available.
+ */
+struct TimeIndex {
+  bool dense = false;
+  int origin = 0;      // opening_time
+  int length = 0;      // closing_time - opening_time
+  int channels = 0;    // dense rows cover channel ids [0, channels)
+
+  // blocked[c*(length+1) + k]: minutes in [origin, origin+k) during which
+  // channel c is outside the allowed list of some active priority block.
+  std::pmr::vector<int> blocked{scratch_or_default()};
+  // covered[g*(length+1) + k]: minutes in [origin, origin+k) covered by a
+  // time preference whose preferred_genre has row g.
+  std::pmr::vector<int> covered{scratch_or_default()};
+  std::pmr::unordered_map<std::string_view, int> genre_row{scratch_or_default()};
+
+  // preferred_genre -> indices into Instance::time_prefs, ascending.
+  std::pmr::unordered_map<std::string_view, std::pmr::vector<size_t>> prefs_by_genre{scratch_or_default()};
+
+  /// Blocked minutes of channel `ch` in [s,e); -1 when not answerable densely.
+  int blocked_minutes(int ch, int s, int e) const {
+    if (!dense || ch < 0 || ch >= channels || s >= e) return -1;
+    s = std::max(s, origin); e = std::min(e, origin + length);
+    if (s >= e) return 0;
+    const int* row = blocked.data() + (size_t)ch * (length + 1);
+    return row[e - origin] - row[s - origin];
+  }
+
+  /// Minutes of [s,e) covered by preferences of `genre`; -1 when not dense.
+  int covered_minutes(std::string_view genre, int s, int e) const {
+    if (!dense) return -1;
+    auto it = genre_row.find(genre);
+    if (it == genre_row.end() || s >= e) return 0;
+    s = std::max(s, origin); e = std::min(e, origin + length);
+    if (s >= e) return 0;
+    const int* row = covered.data() + (size_t)it->second * (length + 1);
+    return row[e - origin] - row[s - origin];
+  }
+};
+
 struct Instance {
   int opening_time=0;    
   int closing_time=0;    
@@ -35,34 +99,86 @@ struct Instance {
   int max_same_genre=999; 
   int S=0;                
   int T=0;                
-  std::vector<Channel> channels;
-  std::vector<PriorityBlock> priority_blocks;
-  std::vector<TimePreference> time_prefs;
+  // Built inside validate(), the containers and lookup maps live in its
+  // scratch arena and must not outlive the call; elsewhere they use the
+  // default resource.
+  std::pmr::vector<Channel> channels{scratch_or_default()};
+  std::pmr::vector<PriorityBlock> priority_blocks{scratch_or_default()};
+  std::pmr::vector<TimePreference> time_prefs{scratch_or_default()};
+  std::pmr::vector<const Program*> programs{scratch_or_default()};   // catalog in input order, by ordinal
+  // Owns the ids and genres above; shared with results that view them, so
+  // it is on the heap whatever the scope.
+  std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();
 
+  std::pmr::unordered_map<std::string_view, const Program*> program_by_id{scratch_or_default()};
+  std::pmr::unordered_map<int, const Channel*> channel_by_id{scratch_or_default()};
 
-  std::unordered_map<std::string, const Program*> program_by_id;
-  std::unordered_map<int, const Channel*> channel_by_id;
+  TimeIndex time_index;
 };
 
 struct SubmissionItem {
-  std::string program_id;
+  std::string_view program_id;  // views the submission document or Submission::strings
   int channel_id=0;
   int start=0, end=0;
+  int program_ordinal=-1;  // Program::ordinal when the caller resolved it; wins over program_id
 };
 
 struct Submission {
-  std::vector<SubmissionItem> items;
+  std::pmr::vector<SubmissionItem> items{scratch_or_default()};
+  // Owns the program ids when the source document did not outlive the
+  // submission (parse_submission()); null otherwise.
+  std::shared_ptr<StringPool> strings;
 };
 
+// Per-program aggregate in evaluate(), stored flat by Program::ordinal.
 struct ProgramStats {
   int full_length = 0;
+  bool seen = false;
   bool has_long_segment = false;
   bool has_full_short = false;
   bool reached_end = false;
-  std::string genre;
-  std::vector<int> pref_overlap;
 };
 
+/**
+ * @brief Parses JSON text into a Document without throwing.
+ * @param text Raw JSON.
+ * @param out Receives the document; null on failure.
+ * @param error Set to the parser's message on failure.
+ * @return false on malformed JSON.
+ */
+bool parse_document(std::string_view text, Document& out, std::string& error);
+
+/**
+ * @brief Destroys the nodes of `doc` through a scratch stack; `doc` is left null.
+ *
+ * basic_json's destructor flattens nested containers through a std::vector
+ * on the global heap. Releasing a scratch document first keeps its
+ * teardown in the arena too.
+ */
+void release_document(Document& doc);
+
+/// Calls release_document() on `doc` when the scope ends.
+class ReleaseOnExit {
+public:
+  explicit ReleaseOnExit(Document& doc) : doc_(doc) {}
+  ~ReleaseOnExit() { release_document(doc_); }
+  ReleaseOnExit(const ReleaseOnExit&) = delete;
+  ReleaseOnExit& operator=(const ReleaseOnExit&) = delete;
+
+private:
+  Document& doc_;
+};
+
+/**
+ * @brief Builds an Instance from a parsed instance document.
+ * @param j Parsed instance JSON.
+ * @param out Receives the instance with its lookup maps.
+ * @param error Set to the first structural error on failure.
+ * @return false on a missing or mistyped field.
+ */
+bool build_instance(const Document& j, Instance& out, std::string& error);
+
+#if TVV_EXCEPTIONS
 /**
  * @brief Parses an instance JSON text into an Instance.
  * @param json_text Raw JSON string.
@@ -71,6 +187,37 @@ struct ProgramStats {
  */
 Instance parse_instance(const std::string& json_text);
 
+/**
+ * @brief Builds an Instance from an already parsed instance document.
+ * @param j Parsed instance JSON.
+ * @return Instance Populated instance with lookup maps.
+ * @throws std::exception on structural errors.
+ */
+Instance parse_instance(const Document& j);
+#endif
+
+/**
+ * @brief Builds Instance::time_index from priority blocks and time preferences.
+ *
+ * The dense tables are skipped (sparse index only) when they would exceed
+ * kDenseIndexMaxCells or when a block/preference is empty or leaves the
+ * opening window.
+ * @param ins Instance to index; called by parse_instance.
+ */
+void build_time_index(Instance& ins);
+
+constexpr size_t kDenseIndexMaxCells = size_t(1) << 20;
+
+/**
+ * @brief Builds a Submission from a parsed submission document.
+ * @param j Parsed submission JSON; the item ids view it, so it must outlive `out`.
+ * @param out Receives the items.
+ * @param error Set to the first structural error on failure.
+ * @return false on a missing or mistyped field.
+ */
+bool build_submission(const Document& j, Submission& out, std::string& error);
+
+#if TVV_EXCEPTIONS
 /**
  * @brief Parses a submission JSON text into a Submission.
  * @param json_text Raw JSON string.
@@ -79,14 +226,114 @@ Instance parse_instance(const std::string& json_text);
  */
 Submission parse_submission(const std::string& json_text);
 
+/**
+ * @brief Builds a Submission from an already parsed submission document.
+ * @param j Parsed submission JSON; the item ids view it.
+ * @return Submission Populated submission items.
+ * @throws std::exception on structural errors.
+ */
+Submission parse_submission(const Document& j);
+#endif
+
+
+// Per-item rule checks, shared by validate() and StreamValidator. Items are
+// visited in timeline order; `index` is the item's timeline position.
+
+/**
+ * @brief MIN_CONTIGUOUS_DURATION_UNDER_D / SHORT_PROGRAM_MUST_BE_FULL, or
+ * PROGRAM_NOT_IN_INSTANCE when the id is unknown.
+ * @return false, with the violation appended, when the item is invalid.
+ */
+bool check_duration(const Instance& ins, const struct TimelineItem& t, int index,
+                    std::vector<struct Violation>& out);
+
+/// PRIORITY_BLOCK_CHANNEL, one violation per block the channel is not allowed in.
+bool check_priority_blocks(const Instance& ins, const struct TimelineItem& t, int index,
+                           std::vector<struct Violation>& out);
+
+/// OUTSIDE_WINDOW.
+bool check_window(const Instance& ins, const struct TimelineItem& t, int index,
+                  std::vector<struct Violation>& out);
+
+/// Rolling MAX_GENRE_RUN state over all items in timeline order.
+struct GenreRun {
+  int max_run = 999;
+  std::string_view last;
+  int run = 0;
+  /// Extends the run with `t`; false when it exceeds max_run.
+  bool push(const struct TimelineItem& t);
+};
+
+struct Violation genre_run_violation(const Instance& ins, const struct TimelineItem& t, int index);
+
+/// Order-independent key of an overlapping pair, to report each pair once.
+void overlap_pair_key(std::pmr::string& key, std::pmr::string& tmp,
+                      const struct TimelineItem& a, const struct TimelineItem& c);
+/// OUTPUT_OVERLAP between an earlier item `a` and item `c` at `index`.
+struct Violation output_overlap_violation(const struct TimelineItem& a, const struct TimelineItem& c,
+                                          int index);
+/// INPUT_OVERLAP for an item referencing a program that overlaps in the input.
+struct Violation input_overlap_violation(const struct TimelineItem& t, int index);
+
+/**
+ * @brief ProgramStats kept as counts over a program's airings, so that an
+ * airing can be removed again (leave-one-out, streaming).
+ */
+struct ProgramAirings {
+  int total = 0, long_segments = 0, full_shorts = 0, reaching_end = 0;
+
+  /// Adds (sign 1) or removes (sign -1) airing `t` of `p`.
+  void add(const Program& p, const struct TimelineItem& t, int D, int sign = 1);
+  /// Program::score when the airings earn base points, else 0.
+  int base(const Program& p, int D) const;
+  /// Whether the program is penalized as EARLY.
+  bool early() const { return total > 0 && reaching_end == 0; }
+};
+
+/// Time-preference bonus earned by one timeline item, as in evaluate().
+int item_bonus(const Instance& ins, const struct TimelineItem& t, int D);
+
+/**
+ * @brief Cooperative deadline and cancellation for the rule loops and evaluate().
+ *
+ * poll() is meant to be called once per item: the flag and the clock are
+ * only read every kPollStride calls. Once tripped it stays tripped.
+ */
+class Interrupt {
+public:
+  using Clock = std::chrono::steady_clock;
+  enum class Reason { None, Timeout, Cancelled };
+  static constexpr unsigned kPollStride = 256;
+
+  Interrupt() = default;
+  Interrupt(std::optional<Clock::time_point> deadline, const std::atomic<bool>* cancel)
+    : deadline_(deadline), cancel_(cancel) {}
+
+  bool poll() {
+    if (reason_ != Reason::None) return true;
+    if ((!deadline_ && !cancel_) || ++ticks_ % kPollStride) return false;
+    return check();
+  }
+  /// Reads the flag and the clock now.
+  bool check();
+  /// Trips the interrupt from inside the validation (e.g. a callback asked to stop).
+  void cancel() { reason_ = Reason::Cancelled; }
+  Reason reason() const { return reason_; }
+
+private:
+  std::optional<Clock::time_point> deadline_;
+  const std::atomic<bool>* cancel_ = nullptr;
+  unsigned ticks_ = 0;
+  Reason reason_ = Reason::None;
+};
 
 struct EvalOutput {
   int base=0, bonuses=0;
   int switches=0, early=0, late=0;
   int total=0;
+  bool interrupted=false;   // stopped by the Interrupt; totals are partial
   std::vector<std::string> debug;
   std::vector<struct Violation> violations;
-  std::vector<struct TimelineItem> timeline;
 };
 
 /**
@@ -98,9 +345,127 @@ struct EvalOutput {
  * @param ins Parsed instance with rules/bonuses/penalties.
  * @param sorted_tl Timeline items sorted by start time.
  * @param verbose If true, fills detailed debug logs.
+ * @param scratch Memory for per-call temporaries (default: global heap).
+ * @param stop Polled once per item when set; see EvalOutput::interrupted.
  * @return EvalOutput Scoring totals, violations, and logs.
  */
 EvalOutput evaluate(const Instance& ins,
-                    const std::vector<TimelineItem>& sorted_tl, bool verbose);
+                    const std::pmr::vector<struct TimelineItem>& sorted_tl, bool verbose,
+                    std::pmr::memory_resource* scratch = std::pmr::get_default_resource(),
+                    Interrupt* stop = nullptr);
+
+class ThreadPool;
+
+/// Shards smaller than this are not worth a task in evaluate_parallel().
+constexpr size_t kParallelEvalMinShardItems = 16 * 1024;
+/// evaluate_parallel() keeps one ProgramStats per program per shard, and
+/// caps shards so that there are this many timeline items per entry.
+constexpr size_t kParallelEvalItemsPerStat = 4;
+
+/**
+ * @brief evaluate() over time shards of the sorted timeline on a thread pool.
+ *
+ * Each shard summarises its items (bonuses, LATE, switches against the
+ * previous item, per-program flags); the summaries are merged and base/EARLY
+ * are decided on the merged flags, so totals equal evaluate() exactly. No
+ * debug log is produced. Short timelines run serially, as do timelines
+ * with too few items per catalog program to pay for the shard tables.
+ *
+ * @param ins Parsed instance with rules/bonuses/penalties.
+ * @param sorted_tl Timeline items sorted by start time.
+ * @param pool Workers to run shards on.
+ * @param shards Shard count; 0 picks 4 per pool thread.
+ * @param scratch Memory for per-call temporaries (default: global heap).
+ * @param stop Polled by every shard on every item, and checked between the
+ * parallel phases, when set.
+ * @return EvalOutput Scoring totals.
+ */
+EvalOutput evaluate_parallel(const Instance& ins,
+                             const std::pmr::vector<struct TimelineItem>& sorted_tl,
+                             ThreadPool& pool, size_t shards = 0,
+                             std::pmr::memory_resource* scratch = std::pmr::get_default_resource(),
+                             Interrupt* stop = nullptr);
+
+/**
+ * @brief Provable upper bound on the total any valid subset of `sub` can score.
+ *
+ * Scoring runs on the items that pass the rule checks, which is not known
+ * before running them, so each term is bounded over every subset: positive
+ * Program::score of each distinct referenced program, positive bonuses of
+ * each item, and no S/T penalty (or the largest gain, if S or T is
+ * negative). Unresolved items contribute nothing, as in evaluate().
+ * @param ins Parsed instance.
+ * @param sub Submission items (program ordinal or id).
+ * @param scratch Memory for per-call temporaries.
+ * @return The bound, saturated to the int range.
+ */
+int score_upper_bound(const Instance& ins, const Submission& sub,
+                      std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
+
+/**
+ * @brief A scored timeline as a linear function of the tunable parameters.
+ *
+ * total = base + sum_j pref_hits[j] * time_prefs[j].bonus
+ *              - switches * S - early_late * T
+ * Which items are scored does not depend on S, T or the bonuses, so one
+ * validation yields the total for any setting of them.
+ */
+struct ScoreCoefficients {
+  int base = 0;
+  std::vector<int> pref_hits;  // by Instance::time_prefs index: items earning the bonus
+  int switches = 0;
+  int early_late = 0;          // early + late count
+};
+
+/**
+ * @brief The coefficients of evaluate()'s total on a sorted timeline.
+ * @param ins Parsed instance.
+ * @param sorted_tl Timeline items sorted by start time.
+ * @param scratch Memory for per-call temporaries (default: global heap).
+ * @return ScoreCoefficients Base points and the per-parameter counts.
+ */
+ScoreCoefficients score_coefficients(const Instance& ins,
+                                     const std::pmr::vector<struct TimelineItem>& sorted_tl,
+                                     std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
+
+/**
+ * @brief Parameter settings for score_batch(), one column per setting.
+ *
+ * Stored as structure of arrays so the scoring loop runs over settings
+ * with unit stride.
+ */
+struct ParamBatch {
+  std::vector<int> S, T;    // one entry per setting
+  std::vector<int> bonus;   // time_prefs.size() rows of size(): bonus[j*size() + i]
+  size_t size() const { return S.size(); }
+};
+
+/**
+ * @brief Totals of one set of coefficients under many parameter settings.
+ * @param c Coefficients from score_coefficients().
+ * @param params Settings; bonus must have c.pref_hits.size() rows.
+ * @param totals Receives params.size() totals, as evaluate() would compute them.
+ */
+void score_batch(const ScoreCoefficients& c, const ParamBatch& params, int* totals);
+
+/**
+ * @brief Each item's leave-one-out delta over the scored subset.
+ *
+ * delta[i] = total(sorted_tl) - total(sorted_tl without item i), with the
+ * validity of every other item held fixed, in O(n + programs): per-program
+ * airing counts tell whether dropping one airing loses base points or the
+ * waiver of EARLY, and switches are re-counted only around the removed
+ * neighbour pair. Rule checks are not re-run, so this is not the score a
+ * resubmission without item i would get: items the rules invalidated
+ * because of it (its overlap partners, a genre run through it) stay
+ * unscored.
+ * @param ins Parsed instance.
+ * @param sorted_tl Timeline items sorted by start time.
+ * @param scratch Memory for per-call temporaries (default: global heap).
+ * @return One delta per item of sorted_tl.
+ */
+std::vector<int> marginal_deltas(const Instance& ins,
+                                 const std::pmr::vector<struct TimelineItem>& sorted_tl,
+                                 std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
 
 } // namespace tvv
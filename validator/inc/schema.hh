@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "rules.hh"
+#include "scratch.hh"
+
+namespace tvv {
+
+/**
+ * @brief A structural, type or reference error in an instance or submission.
+ */
+struct SchemaError {
+  // In the order validate() reports them: the earliest check with an error
+  // decides Result::error_message.
+  enum class Check {
+    InputStructure,    // required instance fields
+    OutputStructure,   // scheduled_programs and its items
+    InputConstraints,  // window, channels, blocks, preferences
+    References,        // scheduled program ids are strings in the catalog
+    ProgramChannel,    // scheduled channel ids are numbers of channels listing the program
+    InputBuild,        // instance values build_instance() cannot convert
+    OutputBuild,       // item values build_submission() cannot convert
+  };
+  Check check;
+  std::string path;     // JSON Pointer (RFC 6901) to the offending value
+  std::string message;
+};
+
+/**
+ * @brief Result::error_message for `e`: the failing check, then the error.
+ * @param e The reported error, usually SchemaErrors::first().
+ * @return E.g. "Input validation failed: Channels count mismatch. ...".
+ */
+std::string error_message(const SchemaError& e);
+
+/**
+ * @brief Error list of a schema pass.
+ *
+ * With `all` false only the first error of each check is kept, which is
+ * enough to pick the reported one and skips formatting the rest.
+ */
+class SchemaErrors {
+public:
+  explicit SchemaErrors(bool all = true) : all_(all) {}
+
+  /// Whether an error of `check` would be kept; callers skip formatting otherwise.
+  bool wants(SchemaError::Check check) const {
+    return all_ || !(seen_ & (1u << (unsigned)check));
+  }
+  void add(SchemaError::Check check, std::string path, std::string message);
+
+  bool empty() const { return errors_.empty(); }
+  /// First error of the earliest failing check; nullptr when empty.
+  const SchemaError* first() const;
+  const std::vector<SchemaError>& errors() const { return errors_; }
+  std::vector<SchemaError> take() { return std::move(errors_); }
+
+private:
+  bool all_;
+  unsigned seen_ = 0;
+  std::vector<SchemaError> errors_;
+};
+
+/**
+ * @brief Channel and program ids of an instance, for the submission
+ * reference checks. Keys view strings of the indexed document (or of the
+ * Instance's pool for a compiled instance).
+ */
+struct CatalogIndex {
+  // Channel id -> position in "channels" of the first channel with it.
+  std::pmr::unordered_map<int, size_t> channel{scratch_or_default()};
+  // Program id -> position of the first channel listing it.
+  std::pmr::unordered_map<std::string_view, size_t> program{scratch_or_default()};
+  bool shared_ids = false;  // some program id is listed by more than one channel
+  // Program id -> positions of the other channels listing it, when shared_ids.
+  std::pmr::unordered_multimap<std::string_view, size_t> also_listed{scratch_or_default()};
+};
+
+/**
+ * @brief Checks an instance document in one walk.
+ *
+ * Records every missing field, type error and constraint violation
+ * (window, channels_count, priority block and preference ranges) with its
+ * path, and indexes the catalog ids on the way.
+ * @param doc Parsed instance JSON.
+ * @param errors Receives the errors.
+ * @param index Filled with the ids of well-formed channels and programs.
+ */
+void check_instance(const Document& doc, SchemaErrors& errors, CatalogIndex& index);
+
+/**
+ * @brief Checks a submission document in one walk and converts it.
+ *
+ * Records structural and type errors of scheduled_programs, and with an
+ * index also unknown programs and channels and programs scheduled on a
+ * channel that does not list them. Each item costs O(1) lookups. A
+ * "schedule" array, when present, supplies the items instead (unchecked
+ * but for their types), as parse_submission() always allowed.
+ * @param doc Parsed submission JSON.
+ * @param index Catalog ids, or nullptr to skip the reference checks.
+ * @param errors Receives the errors.
+ * @param out Filled with the items; meaningful only when no error was found.
+ */
+void check_submission(const Document& doc, const CatalogIndex* index, SchemaErrors& errors,
+                      Submission& out);
+
+/**
+ * @brief The reference checks of check_submission() for one item of a
+ * structured submission, against a built instance.
+ * @param ins The instance.
+ * @param it The item; its program_ordinal wins over program_id.
+ * @param index Position of `it`, for the error path.
+ * @param errors Receives a References or ProgramChannel error.
+ * @return The item's program; nullptr if it is not in the catalog.
+ */
+const Program* check_item_references(const Instance& ins, const SubmissionItem& it, size_t index,
+                                     SchemaErrors& errors);
+
+} // namespace tvv
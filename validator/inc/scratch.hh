@@ -0,0 +1,137 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "json.hpp"
+
+namespace tvv {
+
+/**
+ * @brief Resettable scratch memory for the temporaries of one validate() call.
+ *
+ * A monotonic arena over one owned buffer: deallocation is a no-op and
+ * reset() rewinds to the start. When a call overflowed the buffer, reset()
+ * regrows it to the high-water mark, so repeated calls on similar inputs
+ * stop touching the global heap for scratch data.
+ */
+class ScratchArena : public std::pmr::memory_resource {
+public:
+  explicit ScratchArena(size_t initial_bytes = 64 * 1024);
+  ScratchArena(const ScratchArena&) = delete;
+  ScratchArena& operator=(const ScratchArena&) = delete;
+
+  void reset();
+  size_t capacity() const { return capacity_; }
+  size_t bytes_used() const { return used_; }
+
+private:
+  void* do_allocate(size_t bytes, size_t align) override;
+  void do_deallocate(void*, size_t, size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override {
+    return this == &o;
+  }
+
+  std::unique_ptr<std::byte[]> buffer_;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+  std::optional<std::pmr::monotonic_buffer_resource> mono_;
+};
+
+/**
+ * @brief Append-only store of distinct strings with stable addresses.
+ *
+ * Ids and genres are stored once when an instance is built and passed
+ * around as string_views from then on. Characters and index nodes come from
+ * chunks on the heap, never from a scratch arena, so views stay valid as long
+ * as the pool is alive. Each string is stored NUL-terminated, so data() can
+ * be handed to C callers.
+ */
+class StringPool {
+public:
+  StringPool() = default;
+  StringPool(const StringPool&) = delete;
+  StringPool& operator=(const StringPool&) = delete;
+
+  /// The pooled copy of `s`, stored on first use.
+  std::string_view intern(std::string_view s);
+  /// A copy of `s` without the lookup, for strings that are mostly distinct.
+  std::string_view copy(std::string_view s);
+  /// Number of distinct interned strings.
+  size_t size() const { return index_.size(); }
+
+private:
+  std::pmr::monotonic_buffer_resource chunks_{std::pmr::new_delete_resource()};
+  std::pmr::unordered_set<std::string_view> index_{&chunks_};
+};
+
+/// Resource that ScratchAllocator draws from on this thread (nullptr = heap).
+inline std::pmr::memory_resource*& scratch_resource() {
+  thread_local std::pmr::memory_resource* current = nullptr;
+  return current;
+}
+
+/// scratch_resource(), or the default pmr resource outside a scratch scope.
+inline std::pmr::memory_resource* scratch_or_default() {
+  auto* r = scratch_resource();
+  return r ? r : std::pmr::get_default_resource();
+}
+
+/**
+ * @brief Routes scratch_resource() for the lifetime of the scope.
+ *
+ * Anything allocated through ScratchAllocator inside the scope must also be
+ * destroyed inside it.
+ */
+class ScratchScope {
+public:
+  explicit ScratchScope(std::pmr::memory_resource* r) : prev_(scratch_resource()) {
+    scratch_resource() = r;
+  }
+  ~ScratchScope() { scratch_resource() = prev_; }
+  ScratchScope(const ScratchScope&) = delete;
+  ScratchScope& operator=(const ScratchScope&) = delete;
+
+private:
+  std::pmr::memory_resource* prev_;
+};
+
+/**
+ * @brief Stateless allocator over scratch_resource().
+ *
+ * nlohmann::basic_json default-constructs its allocator for every node, so
+ * the arena has to be found through the thread rather than carried along.
+ */
+template <class T>
+struct ScratchAllocator {
+  using value_type = T;
+
+  ScratchAllocator() = default;
+  template <class U> ScratchAllocator(const ScratchAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    if (auto* r = scratch_resource())
+      return static_cast<T*>(r->allocate(n * sizeof(T), alignof(T)));
+    return std::allocator<T>{}.allocate(n);
+  }
+  void deallocate(T* p, size_t n) noexcept {
+    if (auto* r = scratch_resource()) r->deallocate(p, n * sizeof(T), alignof(T));
+    else std::allocator<T>{}.deallocate(p, n);
+  }
+
+  template <class U> bool operator==(const ScratchAllocator<U>&) const noexcept { return true; }
+  template <class U> bool operator!=(const ScratchAllocator<U>&) const noexcept { return false; }
+};
+
+/// JSON DOM whose nodes live in the active scratch arena (heap outside one).
+using Document = nlohmann::basic_json<std::map, std::vector, std::string, bool,
+                                      std::int64_t, std::uint64_t, double,
+                                      ScratchAllocator>;
+
+} // namespace tvv
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "validator.hh"
+
+namespace tvv {
+
+class ThreadPool;
+
+/**
+ * @brief Thread-safe LRU cache of prepared instances keyed by content hash.
+ */
+class InstanceCache {
+public:
+  explicit InstanceCache(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+  /// The cached instance for `key`, marked most recently used; null if absent.
+  std::shared_ptr<const PreparedInstance> find(std::uint64_t key);
+
+  /// Inserts `pi` under `key` unless an entry exists, evicting the least
+  /// recently used entry when full; returns the entry now cached.
+  std::shared_ptr<const PreparedInstance> insert(std::uint64_t key,
+                                                 std::shared_ptr<const PreparedInstance> pi);
+
+  /**
+   * @brief find() by the hash of `text`, preparing and inserting on a miss.
+   *
+   * A hit is checked against PreparedInstance::content_check.
+   * @param text Instance JSON.
+   * @param key_out Receives the content hash.
+   * @param pool Optional workers for the per-channel checks of a miss.
+   * @return The instance; null if a different instance is cached under the
+   *         same hash.
+   */
+  std::shared_ptr<const PreparedInstance> get_or_prepare(std::string_view text,
+                                                         std::uint64_t* key_out = nullptr,
+                                                         ThreadPool* pool = nullptr);
+
+  size_t size() const;
+
+private:
+  using Entry = std::pair<std::uint64_t, std::shared_ptr<const PreparedInstance>>;
+
+  size_t capacity_;
+  mutable std::mutex mu_;
+  std::list<Entry> lru_;   // front = most recently used
+  std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index_;
+};
+
+struct ServerOptions {
+  std::string socket_path;
+  unsigned threads = 0;        // 0 = hardware concurrency
+  size_t cache_capacity = 64;  // prepared instances kept
+  size_t result_cache_bytes = size_t(64) << 20;  // memoized results; 0 = off
+  size_t max_connections = 64;                   // further clients wait in the backlog
+  size_t max_payload = size_t(32) << 20;         // bytes per instance or submission
+  size_t max_pending = 16;                       // requests in flight per connection
+};
+
+/**
+ * @brief Serves validation requests on a Unix domain socket.
+ *
+ * Each connection carries a stream of requests; a client may send several
+ * before reading, and responses come back in request order. With
+ * ServerOptions::max_pending requests unanswered, the server reads no more
+ * from that connection until a response is written.
+ *
+ *   LOAD <n>\n<n bytes instance JSON>
+ *     Prepares and caches the instance; the body is {"instance":"<hash>"}.
+ *   VALIDATE <ref> <m> [verbose]\n[<n bytes instance JSON>]<m bytes submission JSON>
+ *     <ref> is "#<hash>" of a cached instance, or the byte count n of an
+ *     inline instance, which is cached as by LOAD. The body is to_json().
+ *
+ * Responses are "OK <latency_us> <len>\n<body>" or "ERR <latency_us> <len>\n
+ * <message>", latency being the time spent serving the request once read.
+ * A payload over ServerOptions::max_payload, or a malformed header, is
+ * answered with ERR and ends the connection.
+ *
+ * An existing socket at the path is replaced only if no server answers on
+ * it; any other file there is left alone.
+ * @return Nonzero if the socket could not be set up; otherwise runs until
+ *         the process is stopped.
+ */
+int serve(const ServerOptions& opts);
+
+/// Lower-case 16-digit hex form of an instance hash, as used by the protocol.
+std::string hash_to_hex(std::uint64_t h);
+
+} // namespace tvv
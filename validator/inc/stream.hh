@@ -0,0 +1,99 @@
+#pragma once
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "validator.hh"
+#include "rules.hh"
+
+namespace tvv {
+
+/**
+ * @brief Incremental validation of an append-only schedule, such as a live
+ * playout log.
+ *
+ * Items are pushed in non-decreasing start order. Each one is checked
+ * against rolling state (the MAX_GENRE_RUN run, the OUTPUT_OVERLAP active
+ * set, the tail of the scored list for switches, per-program airing
+ * counts), so a push costs amortized O(1) plus the items it overlaps.
+ * Items sharing a start time are held back until a later start arrives or
+ * finish() is called, so they are checked in the same order as validate()'s
+ * sorted timeline.
+ *
+ * An overlap found later can invalidate an item that was already scored;
+ * score() is therefore provisional, and so is EARLY for programs whose
+ * later airings may still reach the end. finish() returns what validate()
+ * returns for the same items, apart from the debug log.
+ */
+class StreamValidator {
+public:
+  explicit StreamValidator(std::shared_ptr<const PreparedInstance> prepared);
+
+  /**
+   * @brief Appends one item.
+   *
+   * The item is resolved and reference-checked as in validate(). A rejected
+   * item (unknown program, wrong channel, start before the previous item's)
+   * ends the stream: this and later pushes return false and finish()
+   * reports error().
+   * @param item Program (ordinal or id), channel and airing interval.
+   * @return false when the item was rejected.
+   */
+  bool push(const SubmissionItem& item);
+
+  /// Violations found so far, in discovery order. Poll from the size seen last.
+  const std::vector<Violation>& violations() const { return violations_; }
+
+  /// Score of the items checked so far, over the ones still valid.
+  Score score() const;
+
+  /// Items checked so far; pushed items with the latest start may be held back.
+  size_t checked() const { return items_.size(); }
+
+  /// Why the stream was rejected; empty while it is usable.
+  const std::string& error() const { return error_; }
+
+  /**
+   * @brief Checks the held-back items and completes the result.
+   *
+   * Violations are ordered as validate() reports them. The stream must not
+   * be pushed to afterwards.
+   */
+  Result finish();
+
+private:
+  struct Entry {
+    TimelineItem t;
+    int prev = -1, next = -1;    // neighbours in the scored list
+    bool valid = true;
+    bool scored = false;
+    bool input_overlap = false;  // reported once it can no longer overlap a later item
+  };
+
+  void check(TimelineItem t);
+  void flush_pending();
+  void retire(size_t i);
+  void invalidate(size_t i);
+  void add_scored(size_t i);
+  void remove_scored(size_t i);
+
+  std::shared_ptr<const PreparedInstance> prepared_;
+  std::string error_;
+  size_t pushed_ = 0;                   // items accepted by push()
+
+  std::vector<TimelineItem> pending_;   // items with the latest start, not yet checked
+  std::vector<Entry> items_;
+  std::vector<Violation> violations_;
+
+  GenreRun genre_run_;
+  std::vector<size_t> active_;          // checked items that may overlap a later one
+  std::pmr::unordered_set<std::pmr::string> reported_overlaps_;
+  std::pmr::string pair_key_, key_tmp_;
+
+  int tail_ = -1;                       // last scored item
+  std::vector<ProgramAirings> airings_; // by Program::ordinal, scored items only
+  int base_ = 0, bonuses_ = 0, switches_ = 0, late_ = 0, early_ = 0;
+};
+
+} // namespace tvv
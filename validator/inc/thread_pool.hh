@@ -0,0 +1,58 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Builds without pthreads (plain Emscripten) run every task on the caller.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define TVV_NO_THREADS 1
+#endif
+
+namespace tvv {
+
+/**
+ * @brief Fixed-size worker pool shared by the parallel validation paths.
+ */
+class ThreadPool {
+public:
+  /**
+   * @param threads Worker count; 0 picks std::thread::hardware_concurrency().
+   */
+  explicit ThreadPool(unsigned threads = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// Number of threads that run tasks, the caller of parallel_for included.
+  unsigned concurrency() const { return (unsigned)workers_.size() + 1; }
+
+  /**
+   * @brief Runs fn(i) for every i in [0, n) and returns when all are done.
+   *
+   * The calling thread takes part and only waits for iterations already
+   * running elsewhere, so nested use from a worker cannot deadlock.
+   */
+  void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+
+  /**
+   * @brief Queues a task for a worker and returns at once.
+   *
+   * Without workers the task runs on the caller before returning.
+   */
+  void submit(std::function<void()> task);
+
+private:
+  void worker_loop();
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> queue_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+};
+
+} // namespace tvv
@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <ostream>
+#include <string_view>
+
+// TVV_NO_TRACE compiles tracing out: tracing() is constant false and every
+// TraceSpan folds away (the WASM build has nowhere to write a trace).
+
+namespace tvv {
+
+/// The switch behind tracing(); use trace_start()/trace_stop().
+inline std::atomic<bool>& trace_flag() {
+  static std::atomic<bool> on{false};
+  return on;
+}
+
+/// Whether spans are being recorded.
+inline bool tracing() {
+#ifdef TVV_NO_TRACE
+  return false;
+#else
+  return trace_flag().load(std::memory_order_relaxed);
+#endif
+}
+
+/**
+ * @brief Drops any recorded events and starts recording.
+ *
+ * Like trace_write(), it must not run while other threads are inside a
+ * span: their buffers are cleared without a lock.
+ */
+void trace_start();
+/// Stops recording; spans already open still record their end.
+void trace_stop();
+
+/**
+ * @brief Writes the recorded events as Chrome Trace Event JSON.
+ *
+ * The output loads in Perfetto (ui.perfetto.dev) and chrome://tracing:
+ * one track per thread that recorded a span, timestamps in microseconds
+ * from trace_start(). Call it once traced work has finished.
+ */
+void trace_write(std::ostream& out);
+
+/// Appends a begin ('B') or end ('E') event to this thread's buffer.
+void trace_event(const char* name, char phase, std::string_view arg = {});
+
+/**
+ * @brief Begin/end events around a scope, while tracing() is on.
+ *
+ * Off, the cost is one relaxed load and a branch; with TVV_NO_TRACE,
+ * nothing. Events go to a buffer owned by the recording thread, so spans
+ * on pool workers take no lock.
+ */
+class TraceSpan {
+public:
+  /// `name` must outlive the trace (a literal or a rule's kName).
+  explicit TraceSpan(const char* name) {
+    if (tracing()) begin(name, {});
+  }
+  /// `arg` is copied and shown as the span's "detail" argument.
+  TraceSpan(const char* name, std::string_view arg) {
+    if (tracing()) begin(name, arg);
+  }
+  ~TraceSpan() { end(); }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  /// Ends the span before the scope does.
+  void end() {
+    if (name_) trace_event(name_, 'E');
+    name_ = nullptr;
+  }
+
+private:
+  void begin(const char* name, std::string_view arg) {
+    name_ = name;
+    trace_event(name, 'B', arg);
+  }
+  const char* name_ = nullptr;
+};
+
+} // namespace tvv
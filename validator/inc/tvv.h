@@ -0,0 +1,94 @@
+/*
+ * Smart TV Scheduling Validator - C interface.
+ *
+ * Validates schedules given as plain arrays instead of JSON text, for
+ * solvers that score many candidate schedules against one instance.
+ * All functions are thread-safe on distinct results; an instance may be
+ * shared between threads once loaded.
+ */
+#ifndef TVV_H
+#define TVV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__EMSCRIPTEN__)
+#include <emscripten/emscripten.h>
+#define TVV_API EMSCRIPTEN_KEEPALIVE
+#elif defined(__GNUC__)
+#define TVV_API __attribute__((visibility("default")))
+#else
+#define TVV_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tvv_instance tvv_instance;
+
+enum tvv_status { TVV_VALID = 0, TVV_INVALID = 1, TVV_ERROR = 2 };
+
+/* One scheduled item. `program` is the catalog ordinal: programs are
+ * numbered from 0 in input order, channel by channel. */
+typedef struct tvv_item {
+  int32_t program;
+  int32_t channel;
+  int32_t start;
+  int32_t end;
+} tvv_item;
+
+typedef struct tvv_score {
+  int32_t total;
+  int32_t base;
+  int32_t bonuses;
+  int32_t switches;           /* count */
+  int32_t switch_penalty;     /* count * S */
+  int32_t early;
+  int32_t late;
+  int32_t early_late_penalty; /* (early + late) * T */
+} tvv_score;
+
+typedef struct tvv_violation {
+  const char* code;     /* valid until the result is reused or freed */
+  const char* message;
+  int32_t t;
+} tvv_violation;
+
+/* Zero-initialise before first use. A result may be passed to
+ * tvv_validate_items() again; its previous details are released. */
+typedef struct tvv_result {
+  int32_t status;       /* enum tvv_status */
+  tvv_score score;
+  void* impl;           /* owned details; release with tvv_result_free() */
+} tvv_result;
+
+/* Parses and checks an instance. Returns NULL only when out of memory; a
+ * rejected instance is returned too, see tvv_instance_error(). */
+TVV_API tvv_instance* tvv_instance_load(const char* json, size_t len);
+TVV_API void tvv_instance_free(tvv_instance* ins);
+
+/* Why the instance was rejected, or NULL if it is usable. */
+TVV_API const char* tvv_instance_error(const tvv_instance* ins);
+
+TVV_API size_t tvv_instance_program_count(const tvv_instance* ins);
+/* Catalog ordinal of a program id, or -1. */
+TVV_API int32_t tvv_instance_program_ordinal(const tvv_instance* ins, const char* program_id);
+TVV_API const char* tvv_instance_program_id(const tvv_instance* ins, int32_t ordinal);
+
+/* Validates and scores `n` items. Returns out->status. */
+TVV_API int32_t tvv_validate_items(const tvv_instance* ins, const tvv_item* items, size_t n,
+                                   tvv_result* out);
+
+TVV_API size_t tvv_result_violation_count(const tvv_result* r);
+/* Fills `out` with violation `i`; returns 0, or -1 when out of range. */
+TVV_API int32_t tvv_result_violation(const tvv_result* r, size_t i, tvv_violation* out);
+/* Error text for TVV_ERROR results, "" otherwise. */
+TVV_API const char* tvv_result_error(const tvv_result* r);
+TVV_API void tvv_result_free(tvv_result* r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TVV_H */
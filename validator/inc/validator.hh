@@ -1,7 +1,19 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 #include "json.hpp"
+#include "rules.hh"
+#include "schema.hh"
+#include "scratch.hh"
 using nlohmann::json;
 
 namespace tvv {
@@ -21,23 +33,122 @@ struct Violation {
   std::string code; 
   std::string msg;
   int t = -1;         
+  int item = -1;      // index into Result::timeline of the offending item
 };
 
+// program_id and genre view the instance's StringPool (Instance::strings).
 struct TimelineItem {
-  std::string program_id;
+  std::string_view program_id;
   int channel_id = -1;
-  std::string genre;
+  std::string_view genre;
   int start = 0;
   int end   = 0;
+  int program_ordinal = -1;  // Program::ordinal, -1 when unresolved
+};
+
+using Timeline = std::pmr::vector<TimelineItem>;
+
+class ThreadPool;
+class ResultCache;
+
+/// Rules version; part of every result and of result cache keys.
+inline constexpr char kValidatorVersion[] = "1.1";
+
+/**
+ * @brief Revision of what validation returns for given inputs.
+ *
+ * Bumping it is mandatory with every change to the result: to_json()
+ * fields, error messages or their precedence, violation codes, rule or
+ * scoring behaviour. It seeds ResultKey, so results memoized in a
+ * ResultCache or written to a --cache-dir by an older build stop matching
+ * instead of being served stale. Bump kValidatorVersion as well when the
+ * change is visible to users.
+ */
+inline constexpr std::uint32_t kResultRevision = 2;
+
+/// Cost counters of one rule pass; see ValidateOptions::rule_stats.
+struct RuleStats {
+  std::string name;              // one of rule_names()
+  bool enabled = true;           // false when listed in disabled_rules
+  std::uint64_t invocations = 0; // 0 when the instance cannot trip the rule
+  std::uint64_t items = 0;       // timeline items checked
+  std::uint64_t violations = 0;  // violations emitted
+  std::uint64_t ns = 0;          // wall time of the pass
+
+  RuleStats& operator+=(const RuleStats& o) {
+    invocations += o.invocations; items += o.items;
+    violations += o.violations; ns += o.ns;
+    return *this;
+  }
+};
+
+/**
+ * @brief Names of the rule passes, in the order validate() runs them.
+ *
+ * These are the phase names reported to on_phase and the names accepted by
+ * ValidateOptions::disabled_rules.
+ */
+const std::vector<std::string>& rule_names();
+
+struct ValidateOptions {
+  bool verbose = false;
+  // Arena for per-call temporaries. The caller resets it between calls;
+  // nullptr makes validate() use a call-local arena.
+  ScratchArena* arena = nullptr;
+  // Runs per-channel instance checks concurrently and scores large
+  // timelines with evaluate_parallel() (the latter not when verbose).
+  ThreadPool* pool = nullptr;
+  // Serialized results of earlier calls, consulted by validate_to_json()
+  // before any parsing.
+  ResultCache* memo = nullptr;
+  // Top-K mode: when score_upper_bound() is below this, the rule checks
+  // and scoring are skipped and the result is "PRUNED".
+  std::optional<int> prune_below;
+  // When set, receives score_coefficients() of the scored items, for
+  // re-scoring under other S/T/bonus settings with score_batch(). Filled
+  // only for VALID and INVALID results. Bypasses the memo.
+  ScoreCoefficients* coefficients = nullptr;
+  // Fill Result::marginal with marginal_deltas() of the scored items.
+  // Other items' validity is not re-checked without each one.
+  bool marginals = false;
+  // Cooperative limits, polled in every rule loop and in evaluate(). When
+  // the deadline passes or *cancel becomes true, the result is "TIMEOUT" or
+  // "CANCELLED" with Result::phase and the violations found so far.
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+  const std::atomic<bool>* cancel = nullptr;
+  // Progressive delivery. on_violation receives each violation as soon as
+  // it is found, which is then not kept in Result::violations; returning
+  // false stops the validation as "CANCELLED". on_phase is called as each
+  // phase starts ("parse", "references", "timeline", each rule code,
+  // "evaluate"). Either one bypasses the memo.
+  std::function<bool(const Violation&)> on_violation;
+  std::function<void(std::string_view phase)> on_phase;
+  // Rule passes to skip, by rule_names() entry; they report no violations and
+  // invalidate no items. Bypasses the memo.
+  std::vector<std::string> disabled_rules;
+  // Fill Result::rule_stats with one entry per rule pass. Bypasses the memo.
+  bool rule_stats = false;
+  // On "ERROR", list every structural, type and reference error of both
+  // inputs in Result::errors, not only the first failing check.
+  bool all_errors = false;
 };
 
 struct Result {
-  std::string status = "VALID"; // "VALID" | "INVALID" | "ERROR"
+  std::string status = "VALID"; // "VALID" | "INVALID" | "ERROR" | "PRUNED" | "TIMEOUT" | "CANCELLED"
   Score score;
   std::vector<Violation> violations;
   std::vector<TimelineItem> timeline;
-  std::string validator_version = "1.0";
+  std::shared_ptr<const StringPool> strings;  // keeps the timeline's ids and genres alive
+  std::vector<std::uint8_t> valid;  // per timeline item: 1 if it was scored
+  std::string validator_version = kValidatorVersion;
   int elapsed_ms = 0;
+  int upper_bound = 0;              // set when status is "PRUNED"
+  std::string phase;                // where a "TIMEOUT"/"CANCELLED" validation stopped
+  std::vector<int> marginal;        // per timeline item with opts.marginals: delta over
+                                    // the scored subset, validity of the rest fixed (0 if
+                                    // not scored); see marginal_deltas()
+  std::vector<RuleStats> rule_stats; // with opts.rule_stats, in rule order
+  std::vector<SchemaError> errors;   // with opts.all_errors on "ERROR", by JSON path
   std::string error_message;
   std::vector<std::string> debug;
 };
@@ -54,115 +165,160 @@ struct Result {
  * @param verbose If true, collects detailed debug logs.
  * @return Result Structured outcome including status, violations, and score.
  */
-Result validate(const std::string& instance_json,
-                const std::string& submission_json,
+Result validate(std::string_view instance_json,
+                std::string_view submission_json,
                 bool verbose);
 
 /**
- * @brief Serializes a Result to JSON.
- * @param r The result to serialize.
- * @return JSON string representing the result payload.
+ * @brief validate() with explicit options (scratch arena, verbosity).
+ * @param instance_json The scheduling instance JSON.
+ * @param submission_json The submission JSON.
+ * @param opts Call options; see ValidateOptions.
+ * @return Result Structured outcome including status, violations, and score.
  */
-std::string to_json(const Result& r);
-
-//////////////////// input checks ////////////////////
+Result validate(std::string_view instance_json,
+                std::string_view submission_json,
+                const ValidateOptions& opts);
 
 /**
- * @brief Validates required fields and basic shapes in the instance.
- * @param input Parsed instance JSON.
- * @return true if structure is valid; false otherwise.
+ * @brief An instance parsed and checked once, for validating many submissions.
+ *
+ * Holds everything validate() derives from the instance alone. When an
+ * instance stage failed, `failed` records which one so that validating
+ * against it reports the same error, in the same order relative to the
+ * submission checks, as the one-shot validate() would.
  */
-bool validateInputStructure(const nlohmann::json& input);
+struct PreparedInstance {
+  enum class Stage { None, Parse, Structure, Constraints, Build };
+  Stage failed = Stage::None;
+  std::string error;              // exception text for Parse / Build
 
-/**
- * @brief Ensures opening_time < closing_time and within valid bounds.
- * @param input Parsed instance JSON.
- * @return true if times are valid; false otherwise.
- */
-bool validateOpeningAndClosingTime(const nlohmann::json& input);
+  std::uint64_t content_hash = 0; // hash_bytes() of the instance text
+  // keyed_hash() under process_hash_key() of the text this was built from
+  // (the .tvi bytes when compiled); memo hits must match it.
+  std::uint64_t content_check = 0;
+  Document doc;                   // owns the ids `catalog` views; null when compiled
+  Instance ins;
 
-/**
- * @brief Checks that channels exist, are unique, and well-formed.
- * @param input Parsed instance JSON.
- * @return true on success; false otherwise.
- */
-bool validateChannelsCount(const nlohmann::json& input);
+  // Every error check_instance() found, and the catalog ids it indexed
+  // (complete unless the structure check failed).
+  std::vector<SchemaError> schema_errors;
+  CatalogIndex catalog;
 
-/**
- * @brief Validates PriorityBlock ranges and allowed channel lists.
- * @param input Parsed instance JSON.
- * @return true on success; false otherwise.
- */
-bool validatePriorityBlocks(const nlohmann::json& input);
+  // Same-channel overlaps in the catalog, in channel order.
+  struct InputOverlap { int channel_id; const Program* a; const Program* b; };
+  std::pmr::vector<InputOverlap> input_overlaps{scratch_or_default()};
+  std::pmr::unordered_set<std::string_view> overlapped_ids{scratch_or_default()};
+};
 
 /**
- * @brief Validates TimePreference ranges and bonus definitions.
- * @param input Parsed instance JSON.
- * @return true on success; false otherwise.
+ * @brief Parses and checks an instance for reuse across validate() calls.
+ *
+ * The result owns heap memory only, so it can be cached and shared between
+ * threads; it must not be modified once returned.
+ * @param instance_json The scheduling instance JSON.
+ * @param pool Optional workers for the per-channel checks.
+ * @return The prepared instance (never null; see PreparedInstance::failed).
  */
-bool validateTimePreferences(const nlohmann::json& input);
+std::shared_ptr<const PreparedInstance> prepare_instance(std::string_view instance_json,
+                                                         ThreadPool* pool = nullptr);
 
 /**
- * @brief Validates program catalog: ids, times, genres, and scores.
- * @param input Parsed instance JSON.
- * @return true on success; false otherwise.
+ * @brief validate() against an instance prepared with prepare_instance().
+ * @param prepared The prepared instance.
+ * @param submission_json The submission JSON.
+ * @param opts Call options; see ValidateOptions.
+ * @return Result Same outcome as validate() on the instance's text.
  */
-bool validatePrograms(const nlohmann::json& input);
+Result validate(const PreparedInstance& prepared,
+                std::string_view submission_json,
+                const ValidateOptions& opts);
 
 /**
- * @brief Detects overlaps among programs within the same input channel.
- * @param input Parsed instance JSON.
- * @return true if no same-channel overlaps; false otherwise.
+ * @brief validate() on an already-structured submission, without JSON.
+ *
+ * Runs the same reference checks as the JSON path, on resolved programs:
+ * each item must name a catalog program (by ordinal, or by id when the
+ * ordinal is -1) that belongs to the item's channel.
+ * @param prepared The prepared instance.
+ * @param submission Scheduled items.
+ * @param opts Call options; see ValidateOptions.
+ * @return Result Structured outcome including status, violations, and score.
  */
-bool validateProgramOverlapInInput(const nlohmann::json& input);
-
-//////////////////// output checks ////////////////////
+Result validate(const PreparedInstance& prepared,
+                const Submission& submission,
+                const ValidateOptions& opts);
 
 /**
- * @brief Validates presence/type of 'scheduled_programs' in submission.
- * @param output Parsed submission JSON.
- * @return true on success; false otherwise.
+ * @brief to_json(validate(...)), answered from opts.memo when possible.
+ *
+ * On a memo hit neither input is parsed; misses are validated and stored.
+ * A hit needs a matching keyed digest of both inputs (see ResultKey), not
+ * only equal fast hashes.
+ * @param instance_json The scheduling instance JSON.
+ * @param submission_json The submission JSON.
+ * @param opts Call options; see ValidateOptions.
+ * @return JSON string representing the result payload.
  */
-bool validateOutputStructure(const nlohmann::json& output);
+std::string validate_to_json(std::string_view instance_json,
+                             std::string_view submission_json,
+                             const ValidateOptions& opts);
 
 /**
- * @brief Checks the type of num_programs attribute (if exists).
- * @param output Parsed submission JSON.
- * @return true on success; false otherwise.
+ * @brief validate_to_json() against a prepared instance.
+ * @param prepared The prepared instance; its content_hash and content_check
+ *                 key the memo.
+ * @param submission_json The submission JSON.
+ * @param opts Call options; see ValidateOptions.
+ * @return JSON string representing the result payload.
  */
-bool validateNumPrograms(const nlohmann::json& output);
+std::string validate_to_json(const PreparedInstance& prepared,
+                             std::string_view submission_json,
+                             const ValidateOptions& opts);
 
 /**
- * @brief Ensures each scheduled item lies within opening/closing time.
- * @param output Parsed submission JSON.
- * @param opening_time Instance opening time.
- * @param closing_time Instance closing time.
- * @return true on success; false otherwise.
+ * @brief Serializes a Result to JSON.
+ * @param r The result to serialize.
+ * @return JSON string representing the result payload.
  */
-bool validateProgramTimes(const nlohmann::json& output, int opening_time, int closing_time);
+std::string to_json(const Result& r);
 
 /**
- * @brief Detects overlaps between scheduled programs.
- * @param output Parsed submission JSON.
- * @return true if no overlaps; false otherwise.
+ * @brief to_json() of `r` as result caches store it: with elapsed_ms 0.
+ *
+ * A cache hit does no validation, so it must not replay the time the run
+ * that filled the entry took.
+ * @param r The result to serialize.
+ * @param json to_json(r), returned as is when elapsed_ms is already 0.
  */
-bool validateProgramOverlap(const nlohmann::json& output);
+std::string to_cache_json(const Result& r, std::string json);
 
-/**
- * @brief Ensures all scheduled program_ids exist in the instance catalog.
- * @param input Parsed instance JSON.
- * @param output Parsed submission JSON.
- * @return true on success; false otherwise.
- */
-bool validateProgramsExistInInput(const nlohmann::json& input, const nlohmann::json& output);
+/// Leading bytes and format version of to_binary() output.
+inline constexpr char kBinaryResultMagic[4] = {'T', 'V', 'V', 'B'};
+inline constexpr std::uint32_t kBinaryResultVersion = 1;
 
 /**
- * @brief Verifies that each scheduled item’s channel_id matches the program’s channel.
- * @param output Parsed submission JSON.
- * @param input Parsed instance JSON.
- * @return true on success; false otherwise.
+ * @brief Serializes a Result as columnar little-endian arrays.
+ *
+ * For consumers that view the arrays in place (typed arrays over WASM
+ * memory) instead of parsing JSON. Every section starts 4-byte aligned.
+ *
+ *   header   magic "TVVB", u32 version, u32 status (0 VALID, 1 INVALID,
+ *            2 ERROR, 3 PRUNED, 4 TIMEOUT, 5 CANCELLED), i32 score[10] (total,
+ *            base, bonuses, switch count, S, switch total, early, late, T,
+ *            early/late total), u32 items,
+ *            u32 violations, u32 strings, u32 validator_version (string),
+ *            u32 error_message (string, 0xFFFFFFFF if none)
+ *   items    i32 start[], end[], channel[], program[] (string),
+ *            program_ordinal[] (catalog ordinal, -1 if unknown),
+ *            genre[] (string, -1 if none), then u8 valid[]
+ *   violations  i32 code[] (string), item[] (-1 if none), t[], message[] (string)
+ *   strings  u32 offset[strings + 1] (from the table's first byte), UTF-8 bytes
+ *
+ * Strings are deduplicated; debug lines are not included.
+ * @param r The result to serialize.
+ * @return The encoded bytes.
  */
-bool validateProgramAndChannel(const nlohmann::json& output, const nlohmann::json& input);
-
+std::string to_binary(const Result& r);
 
 } // namespace tvv
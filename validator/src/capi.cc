@@ -0,0 +1,161 @@
+#include "tvv.h"
+#include "validator.hh"
+#include <cstring>
+#include <new>
+
+using namespace tvv;
+
+struct tvv_instance {
+  std::shared_ptr<const PreparedInstance> prepared;
+  std::string error;   // empty when usable
+};
+
+static Result* details(const tvv_result* r) {
+  return r ? static_cast<Result*>(r->impl) : nullptr;
+}
+
+static int32_t status_code(const std::string& s) {
+  if (s == "VALID") return TVV_VALID;
+  if (s == "INVALID") return TVV_INVALID;
+  return TVV_ERROR;
+}
+
+static void load(tvv_instance* ins, std::string_view json) {
+  ins->prepared = prepare_instance(json);
+  // An empty submission reports exactly the instance's own error, if any.
+  Result r = validate(*ins->prepared, Submission{}, ValidateOptions{});
+  if (r.status == "ERROR") ins->error = r.error_message;
+}
+
+static void validate_items(const tvv_instance* ins, const tvv_item* items, size_t n, Result& r) {
+  if (!ins || !ins->prepared || (n && !items)) {
+    r = Result();
+    r.status = "ERROR";
+    r.error_message = "null argument";
+    return;
+  }
+  // Reused per thread so a solver's inner loop keeps its buffers.
+  thread_local ScratchArena arena;
+  thread_local Submission sub;
+  const auto& programs = ins->prepared->ins.programs;
+  sub.items.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    SubmissionItem& si = sub.items[i];
+    si.program_ordinal = items[i].program < 0 ? (int)programs.size() : items[i].program;
+    si.channel_id = items[i].channel;
+    si.start = items[i].start;
+    si.end = items[i].end;
+    if ((size_t)si.program_ordinal < programs.size()) si.program_id = programs[si.program_ordinal]->id;
+    else si.program_id = {};
+  }
+  ValidateOptions opts;
+  opts.arena = &arena;
+  r = validate(*ins->prepared, sub, opts);
+  arena.reset();
+}
+
+extern "C" {
+
+// Input errors come back in the Result; with exceptions enabled, anything
+// else thrown (e.g. std::bad_alloc) is reported the same way rather than
+// unwinding into C.
+tvv_instance* tvv_instance_load(const char* json, size_t len) {
+  auto* ins = new (std::nothrow) tvv_instance();
+  if (!ins) return nullptr;
+  const std::string_view text(json ? json : "", json ? len : 0);
+#if TVV_EXCEPTIONS
+  try {
+    load(ins, text);
+  } catch (const std::exception& e) {
+    ins->error = e.what();
+  }
+#else
+  load(ins, text);
+#endif
+  return ins;
+}
+
+void tvv_instance_free(tvv_instance* ins) {
+  delete ins;
+}
+
+const char* tvv_instance_error(const tvv_instance* ins) {
+  if (!ins) return "null instance";
+  return ins->error.empty() ? nullptr : ins->error.c_str();
+}
+
+size_t tvv_instance_program_count(const tvv_instance* ins) {
+  return ins && ins->prepared ? ins->prepared->ins.programs.size() : 0;
+}
+
+int32_t tvv_instance_program_ordinal(const tvv_instance* ins, const char* program_id) {
+  if (!ins || !ins->prepared || !program_id) return -1;
+  const auto& by_id = ins->prepared->ins.program_by_id;
+  auto it = by_id.find(program_id);
+  return it == by_id.end() ? -1 : it->second->ordinal;
+}
+
+const char* tvv_instance_program_id(const tvv_instance* ins, int32_t ordinal) {
+  if (!ins || !ins->prepared) return nullptr;
+  const auto& programs = ins->prepared->ins.programs;
+  if (ordinal < 0 || (size_t)ordinal >= programs.size()) return nullptr;
+  return programs[ordinal]->id.data();  // pooled strings are NUL-terminated
+}
+
+int32_t tvv_validate_items(const tvv_instance* ins, const tvv_item* items, size_t n,
+                           tvv_result* out) {
+  if (!out) return TVV_ERROR;
+  Result* r = details(out);
+  if (!r) {
+    r = new (std::nothrow) Result();
+    if (!r) return out->status = TVV_ERROR;
+    out->impl = r;
+  }
+
+#if TVV_EXCEPTIONS
+  try {
+    validate_items(ins, items, n, *r);
+  } catch (const std::exception& e) {
+    *r = Result();
+    r->status = "ERROR";
+    r->error_message = e.what();
+  }
+#else
+  validate_items(ins, items, n, *r);
+#endif
+
+  out->status = status_code(r->status);
+  const Score& s = r->score;
+  out->score = tvv_score{s.total, s.base, s.bonuses,
+                         s.switches.count, s.switches.total,
+                         s.early_late.early, s.early_late.late, s.early_late.total};
+  return out->status;
+}
+
+size_t tvv_result_violation_count(const tvv_result* r) {
+  const Result* d = details(r);
+  return d ? d->violations.size() : 0;
+}
+
+int32_t tvv_result_violation(const tvv_result* r, size_t i, tvv_violation* out) {
+  const Result* d = details(r);
+  if (!d || !out || i >= d->violations.size()) return -1;
+  const Violation& v = d->violations[i];
+  out->code = v.code.c_str();
+  out->message = v.msg.c_str();
+  out->t = v.t;
+  return 0;
+}
+
+const char* tvv_result_error(const tvv_result* r) {
+  const Result* d = details(r);
+  return d ? d->error_message.c_str() : "";
+}
+
+void tvv_result_free(tvv_result* r) {
+  if (!r) return;
+  delete details(r);
+  r->impl = nullptr;
+}
+
+} // extern "C"
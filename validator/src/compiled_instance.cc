@@ -0,0 +1,256 @@
+#include "compiled_instance.hh"
+#include <unordered_map>
+#include <vector>
+#include "binary_io.hh"
+#include "hash.hh"
+#include "trace.hh"
+
+namespace tvv {
+
+// Header bytes before the first checksummed one: magic, version, checksum.
+static constexpr size_t kChecksumOffset = 8;
+static constexpr size_t kChecksummedFrom = 16;
+
+std::string compile_instance(const PreparedInstance& pi) {
+  TraceSpan span("compile instance");
+  if (pi.failed != PreparedInstance::Stage::None) return {};
+  const Instance& ins = pi.ins;
+
+  // Every string first, since the header holds the table's size.
+  std::unordered_map<std::string_view, std::uint32_t> index;
+  std::vector<std::string_view> strings;
+  size_t string_bytes = 0;
+  auto str = [&](std::string_view s) {
+    auto [it, fresh] = index.emplace(s, (std::uint32_t)strings.size());
+    if (fresh) {
+      strings.push_back(s);
+      string_bytes += s.size() + 1;
+    }
+    return it->second;
+  };
+  const std::uint32_t version = str(kValidatorVersion);
+  std::vector<std::uint32_t> program_id, program_genre, pref_genre;
+  program_id.reserve(ins.programs.size());
+  program_genre.reserve(ins.programs.size());
+  for (const Program* p : ins.programs) {
+    program_id.push_back(str(p->id));
+    program_genre.push_back(str(p->genre));
+  }
+  for (const auto& t : ins.time_prefs) pref_genre.push_back(str(t.preferred_genre));
+  size_t allowed = 0;
+  for (const auto& b : ins.priority_blocks) allowed += b.allowed_channels.size();
+
+  BinaryWriter w;
+  w.bytes(std::string_view(kCompiledInstanceMagic, 4));
+  w.u32(kCompiledInstanceVersion);
+  w.u64(0);  // checksum, patched in below
+  w.u64(pi.content_hash);
+  w.u32(version);
+  for (int v : {ins.opening_time, ins.closing_time, ins.min_duration, ins.max_same_genre, ins.S, ins.T})
+    w.i32(v);
+  for (size_t n : {ins.channels.size(), ins.programs.size(), ins.priority_blocks.size(), allowed,
+                   ins.time_prefs.size(), pi.input_overlaps.size(), strings.size(), string_bytes})
+    w.u32((std::uint32_t)n);
+
+  // Ordinals run channel by channel (see build_instance()), so each
+  // channel's programs are one range of the program arrays.
+  std::uint32_t first = 0;
+  for (const auto& C : ins.channels) w.i32(C.id);
+  w.u32(first);
+  for (const auto& C : ins.channels) w.u32(first += (std::uint32_t)C.programs.size());
+
+  for (std::uint32_t v : program_id) w.u32(v);
+  for (const Program* p : ins.programs) w.i32(p->start);
+  for (const Program* p : ins.programs) w.i32(p->end);
+  for (std::uint32_t v : program_genre) w.u32(v);
+  for (const Program* p : ins.programs) w.i32(p->score);
+
+  for (const auto& b : ins.priority_blocks) w.i32(b.start);
+  for (const auto& b : ins.priority_blocks) w.i32(b.end);
+  first = 0;
+  w.u32(first);
+  for (const auto& b : ins.priority_blocks) w.u32(first += (std::uint32_t)b.allowed_channels.size());
+  for (const auto& b : ins.priority_blocks)
+    for (int ch : b.allowed_channels) w.i32(ch);
+
+  for (const auto& t : ins.time_prefs) w.i32(t.start);
+  for (const auto& t : ins.time_prefs) w.i32(t.end);
+  for (std::uint32_t v : pref_genre) w.u32(v);
+  for (const auto& t : ins.time_prefs) w.i32(t.bonus);
+
+  for (const auto& o : pi.input_overlaps) w.i32(o.channel_id);
+  for (const auto& o : pi.input_overlaps) w.u32((std::uint32_t)o.a->ordinal);
+  for (const auto& o : pi.input_overlaps) w.u32((std::uint32_t)o.b->ordinal);
+
+  std::uint32_t offset = 0;
+  w.u32(offset);
+  for (std::string_view s : strings) w.u32(offset += (std::uint32_t)s.size() + 1);
+  for (std::string_view s : strings) {
+    w.bytes(s);
+    w.u8(0);
+  }
+  w.align4();
+
+  w.patch_u64(kChecksumOffset, hash_bytes(std::string_view(w.str()).substr(kChecksummedFrom)));
+  return w.take();
+}
+
+// Whether `first` is a CSR offset array over `n` elements.
+static bool csr(const std::vector<std::uint32_t>& first, size_t n) {
+  if (first.empty() || first.front() != 0 || first.back() != n) return false;
+  for (size_t i = 1; i < first.size(); ++i)
+    if (first[i] < first[i - 1]) return false;
+  return true;
+}
+
+std::shared_ptr<const PreparedInstance> load_compiled_instance(std::string_view bytes,
+                                                               std::string& error) {
+  TraceSpan span("load compiled instance");
+  if (!is_compiled_instance(bytes)) {
+    error = "not a compiled instance";
+    return nullptr;
+  }
+  BinaryReader r(bytes.substr(4));
+  if (std::uint32_t v = r.u32(); v != kCompiledInstanceVersion) {
+    error = "unsupported compiled instance version " + std::to_string(v);
+    return nullptr;
+  }
+  const std::uint64_t checksum = r.u64();
+  if (!r.ok() || hash_bytes(bytes.substr(kChecksummedFrom)) != checksum) {
+    error = "compiled instance checksum mismatch";
+    return nullptr;
+  }
+
+  // Heap-owned like prepare_instance()'s result, whatever scope is active.
+  ScratchScope heap(nullptr);
+  auto* pi = new PreparedInstance();
+  std::shared_ptr<const PreparedInstance> out(pi, [](const PreparedInstance* p) {
+    ScratchScope heap(nullptr);
+    delete p;
+  });
+  Instance& ins = pi->ins;
+  pi->content_hash = r.u64();
+  pi->content_check = keyed_hash(process_hash_key(), bytes);
+  const std::uint32_t version = r.u32();
+  ins.opening_time = r.i32();
+  ins.closing_time = r.i32();
+  ins.min_duration = r.i32();
+  ins.max_same_genre = r.i32();
+  ins.S = r.i32();
+  ins.T = r.i32();
+  const std::uint32_t nc = r.u32(), np = r.u32(), nb = r.u32(), na = r.u32(),
+                      nt = r.u32(), no = r.u32(), ns = r.u32(), nbytes = r.u32();
+
+  auto channel_id = r.array<std::int32_t>(nc);
+  auto first_program = r.array<std::uint32_t>((size_t)nc + 1);
+  auto program_id = r.array<std::uint32_t>(np);
+  auto program_start = r.array<std::int32_t>(np);
+  auto program_end = r.array<std::int32_t>(np);
+  auto program_genre = r.array<std::uint32_t>(np);
+  auto program_score = r.array<std::int32_t>(np);
+  auto block_start = r.array<std::int32_t>(nb);
+  auto block_end = r.array<std::int32_t>(nb);
+  auto first_allowed = r.array<std::uint32_t>((size_t)nb + 1);
+  auto allowed = r.array<std::int32_t>(na);
+  auto pref_start = r.array<std::int32_t>(nt);
+  auto pref_end = r.array<std::int32_t>(nt);
+  auto pref_genre = r.array<std::uint32_t>(nt);
+  auto pref_bonus = r.array<std::int32_t>(nt);
+  auto overlap_channel = r.array<std::int32_t>(no);
+  auto overlap_a = r.array<std::uint32_t>(no);
+  auto overlap_b = r.array<std::uint32_t>(no);
+  auto string_offset = r.array<std::uint32_t>((size_t)ns + 1);
+  std::string_view table = r.bytes(nbytes);
+
+  auto malformed = [&]() {
+    error = "malformed compiled instance";
+    return nullptr;
+  };
+  if (!r.ok() || !csr(first_program, np) || !csr(first_allowed, na) || !csr(string_offset, nbytes))
+    return malformed();
+
+  // The table moves into the instance's pool in one piece; ids and genres
+  // view that copy.
+  const std::string_view pooled = ins.strings->copy(table);
+  std::vector<std::string_view> strings(ns);
+  for (std::uint32_t k = 0; k < ns; ++k) {
+    const std::uint32_t b = string_offset[k], e = string_offset[k + 1];
+    if (e == b || pooled[e - 1] != '\0') return malformed();
+    strings[k] = pooled.substr(b, e - b - 1);
+  }
+  auto string_at = [&](std::uint32_t k, std::string_view& s) {
+    if (k >= ns) return false;
+    s = strings[k];
+    return true;
+  };
+
+  std::string_view compiled_by;
+  if (!string_at(version, compiled_by)) return malformed();
+  if (compiled_by != kValidatorVersion) {
+    error = "instance compiled by validator " + std::string(compiled_by) + ", this is " +
+            kValidatorVersion + "; recompile it";
+    return nullptr;
+  }
+
+  ins.channels.resize(nc);
+  ins.programs.reserve(np);
+  for (std::uint32_t c = 0; c < nc; ++c) {
+    Channel& C = ins.channels[c];
+    C.id = channel_id[c];
+    C.programs.resize(first_program[c + 1] - first_program[c]);
+    for (std::uint32_t k = first_program[c]; k < first_program[c + 1]; ++k) {
+      Program& p = C.programs[k - first_program[c]];
+      if (!string_at(program_id[k], p.id) || !string_at(program_genre[k], p.genre)) return malformed();
+      p.start = program_start[k];
+      p.end = program_end[k];
+      p.score = program_score[k];
+      p.ordinal = (int)k;
+      ins.programs.push_back(&p);
+      ins.program_by_id[p.id] = &p;
+    }
+    ins.channel_by_id[C.id] = &C;
+  }
+
+  ins.priority_blocks.resize(nb);
+  for (std::uint32_t b = 0; b < nb; ++b) {
+    PriorityBlock& B = ins.priority_blocks[b];
+    B.start = block_start[b];
+    B.end = block_end[b];
+    B.allowed_channels.assign(allowed.begin() + first_allowed[b], allowed.begin() + first_allowed[b + 1]);
+  }
+
+  ins.time_prefs.resize(nt);
+  for (std::uint32_t t = 0; t < nt; ++t) {
+    TimePreference& T = ins.time_prefs[t];
+    if (!string_at(pref_genre[t], T.preferred_genre)) return malformed();
+    T.start = pref_start[t];
+    T.end = pref_end[t];
+    T.bonus = pref_bonus[t];
+  }
+  build_time_index(ins);
+
+  // The catalog index check_instance() would have built from the JSON.
+  CatalogIndex& index = pi->catalog;
+  for (std::uint32_t c = 0; c < nc; ++c) {
+    index.channel.emplace(ins.channels[c].id, c);
+    for (const Program& p : ins.channels[c].programs) {
+      auto [at, fresh] = index.program.emplace(p.id, c);
+      if (!fresh && at->second != c) {
+        index.shared_ids = true;
+        index.also_listed.emplace(at->first, c);
+      }
+    }
+  }
+
+  for (std::uint32_t o = 0; o < no; ++o) {
+    if (overlap_a[o] >= np || overlap_b[o] >= np) return malformed();
+    const Program* a = ins.programs[overlap_a[o]];
+    const Program* b = ins.programs[overlap_b[o]];
+    pi->input_overlaps.push_back({overlap_channel[o], a, b});
+    pi->overlapped_ids.insert(a->id);
+    pi->overlapped_ids.insert(b->id);
+  }
+  return out;
+}
+
+} // namespace tvv
@@ -0,0 +1,116 @@
+#include "mapped_file.hh"
+#include "compiled_instance.hh"
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#if TVV_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tvv {
+
+MappedFile& MappedFile::operator=(MappedFile&& o) noexcept {
+  if (this != &o) {
+    close();
+    addr_ = o.addr_;
+    size_ = o.size_;
+    copy_ = std::move(o.copy_);
+    o.addr_ = nullptr;
+    o.size_ = 0;
+  }
+  return *this;
+}
+
+void MappedFile::close() {
+#if TVV_HAVE_MMAP
+  if (addr_) ::munmap(addr_, size_);
+#endif
+  addr_ = nullptr;
+  size_ = 0;
+  copy_.clear();
+}
+
+#if TVV_HAVE_MMAP
+bool MappedFile::open(const std::string& path, Access access) {
+  close();
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      if (access == Access::Sequential) ::madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+      addr_ = p;
+      size_ = (size_t)st.st_size;
+      ::close(fd);
+      return true;
+    }
+  }
+
+  // Not mappable (pipe, empty or special file): read it.
+  char buf[64 * 1024];
+  ssize_t n;
+  while ((n = ::read(fd, buf, sizeof buf)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ::close(fd);
+      copy_.clear();
+      return false;
+    }
+    copy_.append(buf, (size_t)n);
+  }
+  ::close(fd);
+  return true;
+}
+#else
+bool MappedFile::open(const std::string& path, Access) {
+  close();
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  std::ostringstream ss;
+  ss << f.rdbuf();
+  copy_ = ss.str();
+  return true;
+}
+#endif
+
+std::shared_ptr<const PreparedInstance> prepare_instance_file(const std::string& path,
+                                                              std::string& error,
+                                                              ThreadPool* pool) {
+  MappedFile f;
+  if (!f.open(path, MappedFile::Access::Sequential)) {
+    error = "cannot read " + path;
+    return nullptr;
+  }
+  if (!is_compiled_instance(f.data())) return prepare_instance(f.data(), pool);
+  auto pi = load_compiled_instance(f.data(), error);
+  if (!pi) error = path + ": " + error;
+  return pi;
+}
+
+Result validate_files(const std::string& instance_path,
+                      const std::string& submission_path,
+                      const ValidateOptions& opts) {
+  Result r;
+  r.status = "ERROR";
+  MappedFile instance, submission;
+  if (!instance.open(instance_path, MappedFile::Access::Sequential)) {
+    r.error_message = "cannot read " + instance_path;
+    return r;
+  }
+  if (!submission.open(submission_path, MappedFile::Access::Sequential)) {
+    r.error_message = "cannot read " + submission_path;
+    return r;
+  }
+  if (!is_compiled_instance(instance.data()))
+    return validate(instance.data(), submission.data(), opts);
+  auto pi = load_compiled_instance(instance.data(), r.error_message);
+  if (!pi) return r;
+  return validate(*pi, submission.data(), opts);
+}
+
+} // namespace tvv
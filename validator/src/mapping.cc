@@ -1,11 +1,52 @@
 #include <emscripten/emscripten.h>
 #include "validator.hh"
+#include "result_cache.hh"
+#include <chrono>
 #include <string>
+#include <string_view>
+#include <cstdint>
 #include <cstring>
 #include <cstdlib>
+#include <memory>
+#include <unordered_map>
 
 using namespace tvv;
 
+// Scratch memory reused across calls; reset once each result is built.
+static ScratchArena g_arena;
+// Re-validating the same files (e.g. after switching tabs) is served from here.
+static ResultCache g_memo(16u << 20);
+// Results lent out by validate_buffers() / validate_binary(), by data pointer.
+static std::unordered_map<const char*, std::unique_ptr<std::string>> g_results;
+// Per-call time budget from set_time_budget(); 0 = unlimited.
+static int g_budget_ms = 0;
+// Whether ERROR results list every schema error; see set_all_errors().
+static bool g_all_errors = false;
+
+// Options shared by the validate_* exports.
+static ValidateOptions call_options(int verbose) {
+  ValidateOptions opts;
+  opts.verbose = verbose != 0;
+  opts.arena = &g_arena;
+  opts.all_errors = g_all_errors;
+  if (g_budget_ms > 0)
+    opts.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(g_budget_ms);
+  return opts;
+}
+
+static std::string_view bytes_view(const uint8_t* p, size_t len) {
+  return std::string_view(reinterpret_cast<const char*>(p), p ? len : 0);
+}
+
+// Keeps `s` alive until free_result() and returns its bytes.
+static const char* lend(std::string s, size_t* out_len) {
+  auto held = std::make_unique<std::string>(std::move(s));
+  const char* data = held->data();
+  *out_len = held->size();
+  g_results.emplace(data, std::move(held));
+  return data;
+}
+
 extern "C" {
 
 EMSCRIPTEN_KEEPALIVE
@@ -15,13 +56,14 @@ char* validate_json(
   int verbose,
   int* out_len
 ) {
-  Result r = validate(
-    instance_json ? std::string(instance_json) : std::string(),
-    submission_json ? std::string(submission_json) : std::string(),
-    verbose != 0
+  ValidateOptions opts = call_options(verbose);
+  opts.memo = &g_memo;
+  std::string result_str = validate_to_json(
+    instance_json ? std::string_view(instance_json) : std::string_view(),
+    submission_json ? std::string_view(submission_json) : std::string_view(),
+    opts
   );
-
-  std::string result_str = to_json(r);
+  g_arena.reset();
   
   char* buffer = (char*)std::malloc(result_str.size());
   if (!buffer) {
@@ -41,4 +83,102 @@ void free_buffer(char* p) {
   if (p) std::free(p);
 }
 
+// Zero-copy variant of validate_json(): the inputs are byte ranges the
+// caller wrote into the heap (HEAPU8.set) and are parsed in place, and the
+// result is lent out as ptr/len until free_result().
+EMSCRIPTEN_KEEPALIVE
+const char* validate_buffers(
+  const uint8_t* instance_ptr,
+  size_t instance_len,
+  const uint8_t* submission_ptr,
+  size_t submission_len,
+  int verbose,
+  size_t* out_len
+) {
+  ValidateOptions opts = call_options(verbose);
+  opts.memo = &g_memo;
+  std::string result_str = validate_to_json(
+    bytes_view(instance_ptr, instance_len), bytes_view(submission_ptr, submission_len), opts);
+  g_arena.reset();
+  return lend(std::move(result_str), out_len);
+}
+
+// validate_buffers() returning the columnar encoding of to_binary(), for
+// views over the result arrays without JSON parsing.
+EMSCRIPTEN_KEEPALIVE
+const char* validate_binary(
+  const uint8_t* instance_ptr,
+  size_t instance_len,
+  const uint8_t* submission_ptr,
+  size_t submission_len,
+  int verbose,
+  size_t* out_len
+) {
+  ValidateOptions opts = call_options(verbose);
+  std::string result_bin = to_binary(validate(
+    bytes_view(instance_ptr, instance_len), bytes_view(submission_ptr, submission_len), opts));
+  g_arena.reset();
+  return lend(std::move(result_bin), out_len);
+}
+
+// Receives one JSON event from validate_streaming(): {"type":"violation",
+// "code","message","t","item"} or {"type":"phase","phase"}. Returning 0
+// stops the validation. From JS, a function added with addFunction(f, "iii").
+typedef int (*event_fn)(const char* data, size_t len);
+
+// validate_buffers() that reports each violation through `on_event` as soon
+// as it is found, and phase starts too when `phases` is nonzero. The final
+// result is lent out as by validate_buffers(); its violations list is empty,
+// since they were all delivered as events.
+EMSCRIPTEN_KEEPALIVE
+const char* validate_streaming(
+  const uint8_t* instance_ptr,
+  size_t instance_len,
+  const uint8_t* submission_ptr,
+  size_t submission_len,
+  int verbose,
+  int phases,
+  event_fn on_event,
+  size_t* out_len
+) {
+  ValidateOptions opts = call_options(verbose);
+  std::string event;
+  if (on_event) {
+    opts.on_violation = [&](const Violation& v) {
+      event = json{ {"type", "violation"}, {"code", v.code}, {"message", v.msg},
+                    {"t", v.t}, {"item", v.item} }.dump();
+      return on_event(event.data(), event.size()) != 0;
+    };
+    if (phases) {
+      opts.on_phase = [&](std::string_view phase) {
+        event = json{ {"type", "phase"}, {"phase", phase} }.dump();
+        on_event(event.data(), event.size());
+      };
+    }
+  }
+  std::string result_str = to_json(validate(
+    bytes_view(instance_ptr, instance_len), bytes_view(submission_ptr, submission_len), opts));
+  g_arena.reset();
+  return lend(std::move(result_str), out_len);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void free_result(const char* p) {
+  if (p) g_results.erase(p);
+}
+
+// Later validate_* calls stop after `ms` milliseconds with status "TIMEOUT"
+// and the violations found so far, instead of blocking the tab; 0 lifts it.
+EMSCRIPTEN_KEEPALIVE
+void set_time_budget(int ms) {
+  g_budget_ms = ms > 0 ? ms : 0;
+}
+
+// Later ERROR results carry every structural, type and reference error
+// with its JSON Pointer in "errors", not just the first one's message.
+EMSCRIPTEN_KEEPALIVE
+void set_all_errors(int on) {
+  g_all_errors = on != 0;
+}
+
 } // extern "C"
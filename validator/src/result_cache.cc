@@ -0,0 +1,83 @@
+#include "result_cache.hh"
+#include "hash.hh"
+#include "validator.hh"
+#include <cstdio>
+
+namespace tvv {
+
+ResultKey ResultKey::of(std::uint64_t instance_hash, std::uint64_t instance_check,
+                        std::string_view submission_json,
+                        bool verbose, bool marginals, bool all_errors,
+                        const HashKey& key) {
+  std::uint64_t seed = hash_bytes(std::string_view(kValidatorVersion),
+                                  (std::uint64_t(kResultRevision) << 3) |
+                                  (verbose ? 1 : 0) | (marginals ? 2 : 0) | (all_errors ? 4 : 0));
+  // The instance digest and the seed go into the key, so `check` covers
+  // all three inputs in one pass over the submission.
+  const HashKey bound{key.k0 ^ instance_check, key.k1 ^ seed};
+  return ResultKey{instance_hash, hash_bytes(submission_json, seed),
+                   keyed_hash(bound, submission_json)};
+}
+
+ResultKey ResultKey::of(std::string_view instance_json, std::string_view submission_json,
+                        bool verbose, bool marginals, bool all_errors,
+                        const HashKey& key) {
+  return of(hash_bytes(instance_json), keyed_hash(key, instance_json),
+            submission_json, verbose, marginals, all_errors, key);
+}
+
+std::string ResultKey::hex() const {
+  char buf[33];
+  std::snprintf(buf, sizeof buf, "%016llx%016llx",
+                (unsigned long long)instance, (unsigned long long)submission);
+  return buf;
+}
+
+bool ResultCache::find(const ResultKey& key, std::string& out) {
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  out = it->second->second;
+  return true;
+}
+
+void ResultCache::insert(const ResultKey& key, std::string json) {
+  if (json.size() > max_bytes_) return;
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    bytes_ -= it->second->second.size();
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+  while (!lru_.empty() && bytes_ + json.size() > max_bytes_) {
+    bytes_ -= lru_.back().second.size();
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  bytes_ += json.size();
+  lru_.emplace_front(key, std::move(json));
+  index_[key] = lru_.begin();
+}
+
+size_t ResultCache::bytes() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return bytes_;
+}
+
+size_t ResultCache::hits() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return hits_;
+}
+
+size_t ResultCache::misses() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return misses_;
+}
+
+} // namespace tvv
@@ -1,6 +1,9 @@
 #include "rules.hh"
 #include "validator.hh"
 #include "json.hpp"
+#include "thread_pool.hh"
+#include "trace.hh"
+#include <limits>
 #include <stdexcept>
 #include <algorithm>
 #include <unordered_set>
@@ -10,195 +13,649 @@ using nlohmann::json;
 namespace tvv {
 
 
-static int as_int(const json& j, const char* k) {
-  if (!j.contains(k) || !j[k].is_number_integer())
-    throw std::runtime_error(std::string("Missing/int field: ") + k);
-  return j[k].get<int>();
+// Field readers of the struct builders. Each returns false with `error`
+// set instead of throwing; the texts match what the throwing accessors
+// used to report.
+static bool read_int(const Document& j, const char* k, int& out, std::string& error) {
+  auto it = j.find(k);
+  if (it == j.end() || !it->is_number_integer()) {
+    error = std::string("Missing/int field: ") + k;
+    return false;
+  }
+  out = it->get<int>();
+  return true;
+}
+// String fields view the document.
+static bool read_str(const Document& j, const char* k, std::string_view& out, std::string& error) {
+  auto it = j.find(k);
+  if (it == j.end() || !it->is_string()) {
+    error = std::string("Missing/string field: ") + k;
+    return false;
+  }
+  out = it->get_ref<const std::string&>();
+  return true;
 }
-static std::string as_str(const json& j, const char* k) {
-  if (!j.contains(k) || !j[k].is_string())
-    throw std::runtime_error(std::string("Missing/string field: ") + k);
-  return j[k].get<std::string>();
+// Optional fields, as Document::value(): `out` keeps its default when absent.
+static bool read_opt(const Document& j, const char* k, int& out, std::string& error) {
+  auto it = j.find(k);
+  if (it == j.end()) return true;
+  if (!it->is_number() && !it->is_boolean()) {
+    error = std::string("[json.exception.type_error.302] type must be number, but is ") + it->type_name();
+    return false;
+  }
+  out = it->get<int>();
+  return true;
+}
+static bool read_opt(const Document& j, const char* k, std::string_view& out, std::string& error) {
+  auto it = j.find(k);
+  if (it == j.end()) return true;
+  if (!it->is_string()) {
+    error = std::string("[json.exception.type_error.302] type must be string, but is ") + it->type_name();
+    return false;
+  }
+  out = it->get_ref<const std::string&>();
+  return true;
 }
 
+namespace {
+// Builds a Document from the parser's SAX events, as nlohmann's own DOM
+// builder does, but keeps the parser's message instead of throwing it and
+// the stack of open containers in scratch memory.
+class DomBuilder {
+public:
+  DomBuilder(Document& root, std::string& error) : root_(root), error_(error) {}
+
+  bool null() { add(nullptr); return true; }
+  bool boolean(bool v) { add(v); return true; }
+  bool number_integer(Document::number_integer_t v) { add(v); return true; }
+  bool number_unsigned(Document::number_unsigned_t v) { add(v); return true; }
+  bool number_float(Document::number_float_t v, const Document::string_t&) { add(v); return true; }
+  bool string(Document::string_t& v) { add(v); return true; }
+  bool binary(Document::binary_t& v) { add(Document::binary(std::move(v))); return true; }
+
+  bool start_object(std::size_t) { open_.push_back(add(Document::value_t::object)); return true; }
+  // A repeated key overwrites the earlier value.
+  bool key(Document::string_t& k) { member_ = &(*open_.back())[k]; return true; }
+  bool end_object() { open_.pop_back(); return true; }
+  bool start_array(std::size_t) { open_.push_back(add(Document::value_t::array)); return true; }
+  bool end_array() { open_.pop_back(); return true; }
+
+  template <class Exception>
+  bool parse_error(std::size_t, const std::string&, const Exception& ex) {
+    error_ = ex.what();
+    return false;
+  }
 
-static inline bool overlaps(int s1,int e1,int s2,int e2) {
-  return !(e1 <= s2 || e2 <= s1);
+private:
+  template <class V>
+  Document* add(V&& v) {
+    if (open_.empty()) {
+      root_ = Document(std::forward<V>(v));
+      return &root_;
+    }
+    if (open_.back()->is_array()) {
+      auto& a = open_.back()->get_ref<Document::array_t&>();
+      a.emplace_back(std::forward<V>(v));
+      return &a.back();
+    }
+    *member_ = Document(std::forward<V>(v));
+    return member_;
+  }
+
+  Document& root_;
+  std::string& error_;
+  std::pmr::vector<Document*> open_{scratch_or_default()};
+  Document* member_ = nullptr;
+};
+} // namespace
+
+bool parse_document(std::string_view text, Document& out, std::string& error) {
+  out = Document();
+  DomBuilder sax(out, error);
+  if (Document::sax_parse(text, &sax)) return true;
+  out = Document();
+  return false;
 }
 
-Instance parse_instance(const std::string& txt) {
-  auto j = json::parse(txt);
-  Instance ins;
+void release_document(Document& doc) {
+  // Children are moved out and their container emptied before it is
+  // destroyed, so no destructor finds anything to flatten.
+  std::pmr::vector<Document> stack(scratch_or_default());
+  auto take = [&](Document& d) {
+    if (d.is_array()) {
+      auto& a = d.get_ref<Document::array_t&>();
+      for (auto& e : a)
+        if (e.is_structured()) stack.push_back(std::move(e));
+      a.clear();
+    } else if (d.is_object()) {
+      auto& o = d.get_ref<Document::object_t&>();
+      for (auto& kv : o)
+        if (kv.second.is_structured()) stack.push_back(std::move(kv.second));
+      o.clear();
+    }
+  };
+  take(doc);
+  while (!stack.empty()) {
+    Document d = std::move(stack.back());
+    stack.pop_back();
+    take(d);
+  }
+  doc = Document();
+}
 
-  ins.opening_time   = as_int(j, "opening_time");
-  ins.closing_time   = as_int(j, "closing_time");
-  ins.min_duration   = j.value("min_duration", 1);
-  ins.max_same_genre = j.value("max_consecutive_genre", 999);
-  ins.S = j.value("switch_penalty", 0);
-  ins.T = j.value("termination_penalty", 0);
+static inline bool overlaps(int s1,int e1,int s2,int e2) {
+  return !(e1 <= s2 || e2 <= s1);
+}
 
-  if (!j.contains("channels") || !j["channels"].is_array())
-    throw std::runtime_error("Missing/array: channels");
+bool build_instance(const Document& j, Instance& ins, std::string& error) {
+  ins = Instance();
+
+  if (!read_int(j, "opening_time", ins.opening_time, error) ||
+      !read_int(j, "closing_time", ins.closing_time, error))
+    return false;
+  ins.min_duration = 1;
+  ins.max_same_genre = 999;
+  ins.S = ins.T = 0;
+  if (!read_opt(j, "min_duration", ins.min_duration, error) ||
+      !read_opt(j, "max_consecutive_genre", ins.max_same_genre, error) ||
+      !read_opt(j, "switch_penalty", ins.S, error) ||
+      !read_opt(j, "termination_penalty", ins.T, error))
+    return false;
+
+  auto channels = j.find("channels");
+  if (channels == j.end() || !channels->is_array()) {
+    error = "Missing/array: channels";
+    return false;
+  }
 
-  ins.channels.reserve(j["channels"].size());
+  ins.channels.reserve(channels->size());
+  size_t total = 0;
+  for (auto& jc : *channels)
+    if (auto programs = jc.find("programs"); programs != jc.end() && programs->is_array())
+      total += programs->size();
+  ins.programs.reserve(total);
 
-  for (auto& jc : j["channels"]) {
+  for (auto& jc : *channels) {
     ins.channels.push_back(Channel{});
     Channel& C = ins.channels.back();
 
-    if (jc.contains("channel_id") && jc["channel_id"].is_number_integer())
-      C.id = jc["channel_id"].get<int>();
-    else if (jc.contains("id") && jc["id"].is_number_integer())
-      C.id = jc["id"].get<int>();
-    else
-      throw std::runtime_error("Missing/int field: channel_id (or id)");
-
-    if (!jc.contains("programs") || !jc["programs"].is_array())
-      throw std::runtime_error("Missing/array: channels[].programs");
+    std::string ignored;
+    if (!read_int(jc, "channel_id", C.id, ignored) && !read_int(jc, "id", C.id, ignored)) {
+      error = "Missing/int field: channel_id (or id)";
+      return false;
+    }
 
+    auto programs = jc.find("programs");
+    if (programs == jc.end() || !programs->is_array()) {
+      error = "Missing/array: channels[].programs";
+      return false;
+    }
 
-    C.programs.reserve(jc["programs"].size());
+    C.programs.reserve(programs->size());
 
-    for (auto& jp : jc["programs"]) {
+    for (auto& jp : *programs) {
       C.programs.push_back(Program{});
       Program& p = C.programs.back();
 
-      p.id    = as_str(jp, "program_id"); 
-      p.start = as_int(jp, "start");
-      p.end   = as_int(jp, "end");
-      p.genre = jp.value("genre", std::string{});
-      p.score = jp.value("score", 0);
-
+      if (!read_str(jp, "program_id", p.id, error) ||
+          !read_int(jp, "start", p.start, error) ||
+          !read_int(jp, "end", p.end, error) ||
+          !read_opt(jp, "genre", p.genre, error) ||
+          !read_opt(jp, "score", p.score, error))
+        return false;
+      p.id = ins.strings->copy(p.id);  // ids are (nearly) unique
+      p.genre = ins.strings->intern(p.genre);
+      p.ordinal = (int)ins.programs.size();
+
+      ins.programs.push_back(&p);
       ins.program_by_id[p.id] = &p;
     }
 
     ins.channel_by_id[C.id] = &C;
   }
 
-  if (j.contains("priority_blocks")) {
-    for (auto& pb : j["priority_blocks"]) {
+  // A scalar list reads as itself and null as empty, as a range-for over
+  // the field does.
+  auto elements = [](const Document& v, auto&& f) {
+    if (v.is_array() || v.is_object()) {
+      for (auto& e : v) if (!f(e)) return false;
+      return true;
+    }
+    return v.is_null() || f(v);
+  };
+
+  if (auto blocks = j.find("priority_blocks"); blocks != j.end()) {
+    bool ok = elements(*blocks, [&](const Document& pb) {
       PriorityBlock b;
-      b.start = as_int(pb, "start");
-      b.end   = as_int(pb, "end");
-      if (pb.contains("allowed_channels"))
-        for (auto& ac : pb["allowed_channels"])
+      if (!read_int(pb, "start", b.start, error) || !read_int(pb, "end", b.end, error)) return false;
+      if (auto allowed = pb.find("allowed_channels"); allowed != pb.end()) {
+        bool ok = elements(*allowed, [&](const Document& ac) {
+          if (!ac.is_number() && !ac.is_boolean()) {
+            error = std::string("[json.exception.type_error.302] type must be number, but is ") + ac.type_name();
+            return false;
+          }
           b.allowed_channels.push_back(ac.get<int>());
-      ins.priority_blocks.push_back(b);
-    }
+          return true;
+        });
+        if (!ok) return false;
+      }
+      ins.priority_blocks.push_back(std::move(b));
+      return true;
+    });
+    if (!ok) return false;
   }
 
-  if (j.contains("time_preferences")) {
-    for (auto& tp : j["time_preferences"]) {
+  if (auto prefs = j.find("time_preferences"); prefs != j.end()) {
+    bool ok = elements(*prefs, [&](const Document& tp) {
       TimePreference t;
-      t.start = as_int(tp, "start");
-      t.end   = as_int(tp, "end");
-      t.preferred_genre = tp.value("preferred_genre", std::string{});
-      t.bonus = tp.value("bonus", 0);
-      ins.time_prefs.push_back(t);
-    }
+      if (!read_int(tp, "start", t.start, error) || !read_int(tp, "end", t.end, error) ||
+          !read_opt(tp, "preferred_genre", t.preferred_genre, error) ||
+          !read_opt(tp, "bonus", t.bonus, error))
+        return false;
+      t.preferred_genre = ins.strings->intern(t.preferred_genre);
+      ins.time_prefs.push_back(std::move(t));
+      return true;
+    });
+    if (!ok) return false;
   }
 
+  build_time_index(ins);
+  return true;
+}
+
+#if TVV_EXCEPTIONS
+Instance parse_instance(const std::string& txt) {
+  return parse_instance(Document::parse(txt));
+}
+
+Instance parse_instance(const Document& j) {
+  Instance ins;
+  std::string error;
+  if (!build_instance(j, ins, error)) throw std::runtime_error(error);
   return ins;
 }
+#endif
 
-Submission parse_submission(const std::string& txt) {
-  auto j = json::parse(txt);
-  Submission s;
-  const json* arr = nullptr;
-  if (j.contains("schedule") && j["schedule"].is_array()) arr = &j["schedule"];
-  else if (j.contains("scheduled_programs") && j["scheduled_programs"].is_array()) arr = &j["scheduled_programs"];
-  else throw std::runtime_error("Missing/array: schedule (or scheduled_programs)");
+void build_time_index(Instance& ins) {
+  TimeIndex& ix = ins.time_index;
+  ix = TimeIndex{};
+
+  for (size_t j = 0; j < ins.time_prefs.size(); ++j) {
+    const auto& pref = ins.time_prefs[j];
+    if (!pref.preferred_genre.empty())
+      ix.prefs_by_genre[pref.preferred_genre].push_back(j);
+  }
 
-  s.items.reserve(arr->size()); 
+  const int O = ins.opening_time, E = ins.closing_time;
+  if (O >= E) return;
+  auto inside = [&](int s, int e){ return O <= s && s < e && e <= E; };
+  for (const auto& b : ins.priority_blocks)
+    if (!b.allowed_channels.empty() && !inside(b.start, b.end)) return;
+  for (const auto& pref : ins.time_prefs)
+    if (!pref.preferred_genre.empty() && !inside(pref.start, pref.end)) return;
+
+  // Sizes in 64 bits, each bounded before the product: a channel id near
+  // INT_MAX or a wide window must not wrap (size_t is 32 bits in WASM).
+  int max_ch = -1;
+  for (const auto& C : ins.channels) max_ch = std::max(max_ch, C.id);
+  const std::uint64_t span = (std::uint64_t)((std::int64_t)E - O) + 1;
+  const std::uint64_t channel_rows = (std::uint64_t)((std::int64_t)max_ch + 1);
+  if (channel_rows >= kDenseIndexMaxCells || span > kDenseIndexMaxCells) return;
+  const std::uint64_t rows = channel_rows + ix.prefs_by_genre.size();
+  if (rows * span > kDenseIndexMaxCells) return;
+  const size_t width = (size_t)span;
+
+  ix.origin   = O;
+  ix.length   = E - O;
+  ix.channels = max_ch + 1;
+
+  // Difference arrays first, prefix sums after.
+  ix.blocked.assign((size_t)ix.channels * width, 0);
+  std::pmr::vector<int> allowed(scratch_or_default());
+  for (const auto& b : ins.priority_blocks) {
+    if (b.allowed_channels.empty()) continue;
+    allowed.assign(ix.channels, 0);
+    for (int ch : b.allowed_channels)
+      if (ch >= 0 && ch < ix.channels) allowed[ch] = 1;
+    for (int ch = 0; ch < ix.channels; ++ch) {
+      if (allowed[ch]) continue;
+      int* row = ix.blocked.data() + (size_t)ch * width;
+      row[b.start - O] += 1;
+      row[b.end - O]   -= 1;
+    }
+  }
+
+  ix.covered.assign(ix.prefs_by_genre.size() * width, 0);
+  int g = 0;
+  for (const auto& [genre, idxs] : ix.prefs_by_genre) {
+    ix.genre_row[genre] = g;
+    int* row = ix.covered.data() + (size_t)g * width;
+    for (size_t j : idxs) {
+      row[ins.time_prefs[j].start - O] += 1;
+      row[ins.time_prefs[j].end - O]   -= 1;
+    }
+    ++g;
+  }
+
+  // Turn difference arrays into "minutes in [O, O+k) with count > 0".
+  auto accumulate = [width](std::pmr::vector<int>& table) {
+    for (size_t r = 0; r * width < table.size(); ++r) {
+      int* row = table.data() + r * width;
+      int active = 0, minutes = 0;
+      for (size_t k = 0; k < width; ++k) {
+        int delta = row[k];
+        row[k] = minutes;
+        active += delta;
+        if (active > 0) ++minutes;
+      }
+    }
+  };
+  accumulate(ix.blocked);
+  accumulate(ix.covered);
+  ix.dense = true;
+}
+
+bool build_submission(const Document& j, Submission& s, std::string& error) {
+  s.items.clear();
+  const Document* arr = nullptr;
+  if (auto f = j.find("schedule"); f != j.end() && f->is_array()) arr = &*f;
+  else if (auto f = j.find("scheduled_programs"); f != j.end() && f->is_array()) arr = &*f;
+  else {
+    error = "Missing/array: schedule (or scheduled_programs)";
+    return false;
+  }
+
+  s.items.reserve(arr->size());
 
   for (auto& it : *arr) {
     SubmissionItem si;
-    si.program_id = as_str(it, "program_id"); 
-    si.channel_id = as_int(it, "channel_id"); 
-    si.start      = as_int(it, "start");
-    si.end        = as_int(it, "end");
-    s.items.push_back(si);
+    if (!read_str(it, "program_id", si.program_id, error) ||
+        !read_int(it, "channel_id", si.channel_id, error) ||
+        !read_int(it, "start", si.start, error) ||
+        !read_int(it, "end", si.end, error))
+      return false;
+    s.items.push_back(std::move(si));
   }
+  return true;
+}
+
+#if TVV_EXCEPTIONS
+Submission parse_submission(const std::string& txt) {
+  const Document j = Document::parse(txt);
+  Submission s = parse_submission(j);
+  // The ids view `j`; give them a pool that lives with the submission.
+  s.strings = std::make_shared<StringPool>();
+  for (auto& it : s.items) it.program_id = s.strings->intern(it.program_id);
   return s;
 }
 
-// ------------------ evaluation ------------------
-EvalOutput evaluate(const Instance& ins,
-                    const std::vector<TimelineItem>& sorted_tl, bool verbose) {
-  EvalOutput out;
-  out.timeline = sorted_tl;
-   auto logv = [&](const std::string& s){
-    if (verbose) out.debug.push_back(s);
-  };
+Submission parse_submission(const Document& j) {
+  Submission s;
+  std::string error;
+  if (!build_submission(j, s, error)) throw std::runtime_error(error);
+  return s;
+}
+#endif
 
-  logv("=== EVALUATE START ===");
-  logv("Items: " + std::to_string(sorted_tl.size()));
+// ------------------ per-item rule checks ------------------
 
-  std::unordered_map<std::string, ProgramStats> stats;
-  const int D = ins.min_duration;
+static const Program* program_of(const Instance& ins, const TimelineItem& item) {
+  if (item.program_ordinal >= 0 && (size_t)item.program_ordinal < ins.programs.size())
+    return ins.programs[item.program_ordinal];
+  auto itp = ins.program_by_id.find(item.program_id);
+  return itp == ins.program_by_id.end() ? nullptr : itp->second;
+}
 
-  for (const auto& item : sorted_tl) {
-    auto itp = ins.program_by_id.find(item.program_id);
-    if (itp == ins.program_by_id.end()) continue;
-    const Program* p = itp->second;
-
-    auto& ps = stats[item.program_id];
-    if (ps.full_length == 0) {
-      ps.full_length = p->end - p->start;
-      ps.genre = p->genre;
-      ps.pref_overlap.assign(ins.time_prefs.size(), 0);
+bool check_duration(const Instance& ins, const TimelineItem& t, int index,
+                    std::vector<Violation>& out) {
+  const Program* p = program_of(ins, t);
+  if (!p) {
+    out.push_back(Violation{
+      "PROGRAM_NOT_IN_INSTANCE",
+      "INVALID: Program '" + std::string(t.program_id) + "' not found in instance when checking duration constraints.",
+      t.start, index
+    });
+    return false;
+  }
+
+  const int W = t.end - t.start;
+  const int L = p->end - p->start;
+  const int D = ins.min_duration;
+  if (L >= D) {
+    if (W < D) {
+      out.push_back(Violation{
+        "MIN_CONTIGUOUS_DURATION_UNDER_D",
+        "INVALID: Program '" + std::string(t.program_id) + "' scheduled for " + std::to_string(W) +
+        " min, which is less than required minimum of " + std::to_string(D) + " min.",
+        t.start, index
+      });
+      return false;
     }
+  } else if (W != L) {
+    out.push_back(Violation{
+      "SHORT_PROGRAM_MUST_BE_FULL",
+      "INVALID: Program '" + std::string(t.program_id) + "' is shorter than D (" + std::to_string(L) +
+      " min < " + std::to_string(D) + " min) and must be scheduled in full; got " + std::to_string(W) + " min.",
+      t.start, index
+    });
+    return false;
+  }
+  return true;
+}
 
-    int scheduled_minutes = item.end - item.start;
+bool GenreRun::push(const TimelineItem& t) {
+  if (t.genre.empty()) { last = {}; run = 0; return true; }
+  if (t.genre == last) {
+    run++;
+  } else {
+    last = t.genre;
+    run = 1;
+  }
+  return run <= max_run;
+}
 
-    if (ps.full_length >= D && scheduled_minutes >= D)
-      ps.has_long_segment = true;
+Violation genre_run_violation(const Instance& ins, const TimelineItem& t, int index) {
+  return Violation{
+    "MAX_GENRE_RUN",
+    "INVALID: More than " + std::to_string(ins.max_same_genre) +
+    " consecutive programs of genre '" + std::string(t.genre) + "'. Offending program: '" + std::string(t.program_id) + "'.",
+    t.start, index
+  };
+}
 
-    if (ps.full_length <  D && scheduled_minutes == ps.full_length)
-      ps.has_full_short = true;
+bool check_priority_blocks(const Instance& ins, const TimelineItem& t, int index,
+                           std::vector<Violation>& out) {
+  // Dense index answers "no blocked minute in [start,end)" in O(1); only
+  // items that touch a block they are not allowed in walk the block list.
+  if (ins.time_index.blocked_minutes(t.channel_id, t.start, t.end) == 0) return true;
+  bool ok = true;
+  for (const auto& b : ins.priority_blocks) {
+    if (b.allowed_channels.empty() || !overlaps(t.start, t.end, b.start, b.end)) continue;
+    bool allowed = std::find(b.allowed_channels.begin(), b.allowed_channels.end(),
+                             t.channel_id) != b.allowed_channels.end();
+    if (allowed) continue;
+    out.push_back(Violation{
+      "PRIORITY_BLOCK_CHANNEL",
+      "INVALID: Program '" + std::string(t.program_id) + "' is scheduled in Channel " + std::to_string(t.channel_id) +
+      " during the priority block [" + std::to_string(b.start) + "-" + std::to_string(b.end) + "], but this channel is not allowed in this block.",
+      t.start, index
+    });
+    ok = false;
+  }
+  return ok;
+}
 
-    if (item.end >= p->end)
-      ps.reached_end = true;
+bool check_window(const Instance& ins, const TimelineItem& t, int index,
+                  std::vector<Violation>& out) {
+  const int O = ins.opening_time;
+  const int E = ins.closing_time;
+  if (t.start >= O && t.end <= E) return true;
+  out.push_back(Violation{
+    "OUTSIDE_WINDOW",
+    "INVALID: Program '" + std::string(t.program_id) + "' is scheduled outside the global window [" +
+      std::to_string(O) + "," + std::to_string(E) + ").",
+    t.start, index
+  });
+  return false;
+}
 
+void overlap_pair_key(std::pmr::string& key, std::pmr::string& tmp,
+                      const TimelineItem& a, const TimelineItem& c) {
+  auto mk_key = [](std::pmr::string& k, const TimelineItem& X){
+    k.clear();
+    k.append(X.program_id).append("|ch").append(std::to_string(X.channel_id))
+     .append("|").append(std::to_string(X.start)).append("-").append(std::to_string(X.end));
+  };
+  mk_key(key, a);
+  mk_key(tmp, c);
+  if (tmp < key) key.swap(tmp);
+  key.append("||").append(tmp);
+}
 
-    for (size_t j = 0; j < ins.time_prefs.size(); ++j) {
-      const auto& pref = ins.time_prefs[j];
-      if (!pref.preferred_genre.empty() && ps.genre == pref.preferred_genre) {
-        int overlap_start = std::max(item.start, pref.start);
-        int overlap_end   = std::min(item.end,   pref.end);
-        int overlap_len   = std::max(0, overlap_end - overlap_start);
-        if (overlap_len > ps.pref_overlap[j]) ps.pref_overlap[j] = overlap_len;
-      }
-    }
+Violation output_overlap_violation(const TimelineItem& A, const TimelineItem& C, int index) {
+  return Violation{
+    "OUTPUT_OVERLAP",
+    "INVALID: Overlap between '" + std::string(A.program_id) + "' [ch " + std::to_string(A.channel_id) +
+      ", " + std::to_string(A.start) + "-" + std::to_string(A.end) + "] and '" +
+      std::string(C.program_id) + "' [ch " + std::to_string(C.channel_id) + ", " +
+      std::to_string(C.start) + "-" + std::to_string(C.end) + "].",
+    std::min(A.start, C.start), index
+  };
+}
+
+Violation input_overlap_violation(const TimelineItem& t, int index) {
+  return Violation{
+    "INPUT_OVERLAP",
+    "INVALID: Referenced program '" + std::string(t.program_id) +
+    "' overlaps with another program in the input; excluded from scoring.",
+    t.start, index
+  };
+}
+
+bool Interrupt::check() {
+  if (reason_ != Reason::None) return true;
+  if (cancel_ && cancel_->load(std::memory_order_relaxed)) reason_ = Reason::Cancelled;
+  else if (deadline_ && Clock::now() >= *deadline_) reason_ = Reason::Timeout;
+  return reason_ != Reason::None;
+}
+
+// ------------------ evaluation ------------------
+
+// Timeline items normally carry their program ordinal; fall back to the id
+// map for items built by hand.
+static void accumulate(ProgramStats& ps, const Program& p, const TimelineItem& item, int D) {
+  if (!ps.seen) {
+    ps.seen = true;
+    ps.full_length = p.end - p.start;
+  }
+
+  int scheduled_minutes = item.end - item.start;
+
+  if (ps.full_length >= D && scheduled_minutes >= D)
+    ps.has_long_segment = true;
+
+  if (ps.full_length <  D && scheduled_minutes == ps.full_length)
+    ps.has_full_short = true;
+
+  if (item.end >= p.end)
+    ps.reached_end = true;
+}
+
+static bool eligible_for_base(const ProgramStats& ps, int D) {
+  return (ps.full_length >= D) ? ps.has_long_segment : ps.has_full_short;
+}
+
+void ProgramAirings::add(const Program& p, const TimelineItem& t, int D, int sign) {
+  const int full_length = p.end - p.start;
+  const int scheduled_minutes = t.end - t.start;
+  total += sign;
+  if (full_length >= D && scheduled_minutes >= D) long_segments += sign;
+  if (full_length < D && scheduled_minutes == full_length) full_shorts += sign;
+  if (t.end >= p.end) reaching_end += sign;
+}
+
+int ProgramAirings::base(const Program& p, int D) const {
+  if (!total) return 0;
+  bool eligible = p.end - p.start >= D ? long_segments > 0 : full_shorts > 0;
+  return eligible ? p.score : 0;
+}
+
+// Bonus of one item without logging; same rule as the loop in evaluate().
+int item_bonus(const Instance& ins, const TimelineItem& t, int D) {
+  if (t.genre.empty()) return 0;
+  auto itg = ins.time_index.prefs_by_genre.find(t.genre);
+  if (itg == ins.time_index.prefs_by_genre.end()) return 0;
+  int covered = ins.time_index.covered_minutes(t.genre, t.start, t.end);
+  if (covered >= 0 && covered < D) return 0;
+
+  int bonus = 0;
+  for (size_t j : itg->second) {
+    const auto& pref = ins.time_prefs[j];
+    int inter_len = std::max(0, std::min(t.end, pref.end) - std::max(t.start, pref.start));
+    if (inter_len >= D) bonus += pref.bonus;
+  }
+  return bonus;
+}
+
+// kBonuses is false for instances without time preferences, which can award
+// no bonus; the per-item genre lookup is then compiled out.
+template <bool kBonuses>
+static EvalOutput evaluate_impl(const Instance& ins,
+                                const std::pmr::vector<TimelineItem>& sorted_tl, bool verbose,
+                                std::pmr::memory_resource* scratch, Interrupt* stop) {
+  EvalOutput out;
+   auto logv = [&](const std::string& s){
+    if (verbose) out.debug.push_back(s);
+  };
+  // Polled once per item; a tripped Interrupt ends the evaluation early.
+  auto stopped = [&]{ return stop && (out.interrupted = stop->poll()); };
+
+  if (verbose) logv("=== EVALUATE START ===");
+  if (verbose) logv("Items: " + std::to_string(sorted_tl.size()));
+
+  std::pmr::vector<ProgramStats> stats(ins.programs.size(), scratch);
+  const int D = ins.min_duration;
+
+  for (const auto& item : sorted_tl) {
+    if (stopped()) return out;
+    const Program* p = program_of(ins, item);
+    if (!p) continue;
+    accumulate(stats[p->ordinal], *p, item, D);
   }
 
   // Base points
   int base_sum = 0;
-  for (const auto& [program_id, ps] : stats) {
-    bool eligible = (ps.full_length >= D) ? ps.has_long_segment : ps.has_full_short;
-    if (!eligible) continue;
-
-    auto itp = ins.program_by_id.find(program_id);
-    if (itp != ins.program_by_id.end()) {
-      base_sum += itp->second->score;
-      logv(" + base: " + program_id + " → " + std::to_string(itp->second->score));
-    } else {
-      logv(" ! base: " + program_id + " not in instance");
-    }
+  for (size_t k = 0; k < stats.size(); ++k) {
+    if (stopped()) return out;
+    const auto& ps = stats[k];
+    if (!ps.seen || !eligible_for_base(ps, D)) continue;
+
+    const Program* p = ins.programs[k];
+    base_sum += p->score;
+    if (verbose) logv(" + base: " + std::string(p->id) + " → " + std::to_string(p->score));
   }
   out.base = base_sum;
-  logv("Base total = " + std::to_string(out.base));
+  if (verbose) logv("Base total = " + std::to_string(out.base));
 
 // Bonus points  (must have at least D minutes inside preferred interval)
 
 int bonus_sum = 0;
 
-for (const auto& t : sorted_tl) {
+if constexpr (kBonuses) for (const auto& t : sorted_tl) {
+  if (stopped()) return out;
   if (t.genre.empty()) continue;
 
-  for (const auto& pref : ins.time_prefs) {
-    if (pref.preferred_genre.empty()) continue;
-    if (t.genre != pref.preferred_genre) continue;
+  auto itg = ins.time_index.prefs_by_genre.find(t.genre);
+  if (itg == ins.time_index.prefs_by_genre.end()) continue;
+
+  // No single preference can hold D minutes if all of them together don't.
+  if (!verbose) {
+    int covered = ins.time_index.covered_minutes(t.genre, t.start, t.end);
+    if (covered >= 0 && covered < D) continue;
+  }
+
+  for (size_t j : itg->second) {
+    const auto& pref = ins.time_prefs[j];
 
     int inter_start = std::max(t.start, pref.start);
     int inter_end   = std::min(t.end,   pref.end);
@@ -206,12 +663,12 @@ for (const auto& t : sorted_tl) {
 
     if (inter_len >= D) {
       bonus_sum += pref.bonus;
-      logv("[BONUS] +" + std::to_string(pref.bonus) + " for " + t.program_id +
-           " (genre " + t.genre + ") with " + std::to_string(inter_len) +
+      if (verbose) logv("[BONUS] +" + std::to_string(pref.bonus) + " for " + std::string(t.program_id) +
+           " (genre " + std::string(t.genre) + ") with " + std::to_string(inter_len) +
            " min inside [" + std::to_string(pref.start) + "-" + std::to_string(pref.end) + "] (>= D=" +
            std::to_string(D) + ")");
     } else {
-      logv("[NO BONUS] " + t.program_id + " has only " + std::to_string(inter_len) +
+      if (verbose) logv("[NO BONUS] " + std::string(t.program_id) + " has only " + std::to_string(inter_len) +
            " min inside preferred interval [" + std::to_string(pref.start) + "-" +
            std::to_string(pref.end) + "] (< D=" + std::to_string(D) + ")");
     }
@@ -219,22 +676,23 @@ for (const auto& t : sorted_tl) {
 }
 
 out.bonuses = bonus_sum;
-logv("Bonus total = " + std::to_string(out.bonuses));
+if (verbose) logv("Bonus total = " + std::to_string(out.bonuses));
 
 // Switch penalty
   int switches = 0;
   for (size_t i = 1; i < sorted_tl.size(); ++i) {
+    if (stopped()) return out;
     if (sorted_tl[i].channel_id != sorted_tl[i-1].channel_id) {
       switches++;
-            logv("[SWITCH] " + sorted_tl[i-1].program_id + "(ch " +
+            if (verbose) logv("[SWITCH] " + std::string(sorted_tl[i-1].program_id) + "(ch " +
            std::to_string(sorted_tl[i-1].channel_id) + ") -> " +
-           sorted_tl[i].program_id + "(ch " +
+           std::string(sorted_tl[i].program_id) + "(ch " +
            std::to_string(sorted_tl[i].channel_id) + ")");
     }
   }
   out.switches = switches;
   const int switches_pen = switches * ins.S;
-    logv("Switches=" + std::to_string(out.switches) + " S=" + std::to_string(ins.S) +
+    if (verbose) logv("Switches=" + std::to_string(out.switches) + " S=" + std::to_string(ins.S) +
        " penalty=" + std::to_string(switches_pen));
 
   // T penalty for early/late termination
@@ -242,37 +700,277 @@ logv("Bonus total = " + std::to_string(out.bonuses));
   int early_end_count  = 0;
 
   for (const auto& item : sorted_tl) {
-    auto itp = ins.program_by_id.find(item.program_id);
-    if (itp == ins.program_by_id.end()) continue;
-    const Program* p = itp->second;
+    if (stopped()) return out;
+    const Program* p = program_of(ins, item);
+    if (!p) continue;
     if (item.start > p->start) {
       late_start_count++;
-      logv("[LATE] " + item.program_id + " started at " + std::to_string(item.start) +
+      if (verbose) logv("[LATE] " + std::string(item.program_id) + " started at " + std::to_string(item.start) +
            " > scheduled " + std::to_string(p->start));
     }
   }
 
-  for (const auto& [program_id, ps] : stats) {
+  for (size_t k = 0; k < stats.size(); ++k) {
+    if (stopped()) return out;
+    const auto& ps = stats[k];
+    if (!ps.seen) continue;
     if (!ps.reached_end) {
       early_end_count++;
-      logv("[EARLY] penalized: " + program_id + " (no airing reached its end)");
+      if (verbose) logv("[EARLY] penalized: " + std::string(ins.programs[k]->id) + " (no airing reached its end)");
     } else {
-      logv("[EARLY] waived: " + program_id + " (at least one airing reached the end)");
+      if (verbose) logv("[EARLY] waived: " + std::string(ins.programs[k]->id) + " (at least one airing reached the end)");
     }
   }
 
   out.late  = late_start_count;
   out.early = early_end_count;
   const int early_late_pen = (late_start_count + early_end_count) * ins.T;
-  logv("Early=" + std::to_string(out.early) + " Late=" + std::to_string(out.late) +
+  if (verbose) logv("Early=" + std::to_string(out.early) + " Late=" + std::to_string(out.late) +
        " T=" + std::to_string(ins.T) +
        " penalty=" + std::to_string(early_late_pen));
 
-  out.timeline = sorted_tl;        
   out.total = out.base + out.bonuses - switches_pen - early_late_pen;
-    logv("[TOTAL] " + std::to_string(out.total));
-  logv("=== EVALUATE END ===");
+    if (verbose) logv("[TOTAL] " + std::to_string(out.total));
+  if (verbose) logv("=== EVALUATE END ===");
+
+  return out;
+}
+
+EvalOutput evaluate(const Instance& ins,
+                    const std::pmr::vector<TimelineItem>& sorted_tl, bool verbose,
+                    std::pmr::memory_resource* scratch, Interrupt* stop) {
+  return ins.time_prefs.empty()
+    ? evaluate_impl<false>(ins, sorted_tl, verbose, scratch, stop)
+    : evaluate_impl<true>(ins, sorted_tl, verbose, scratch, stop);
+}
+
+int score_upper_bound(const Instance& ins, const Submission& sub,
+                      std::pmr::memory_resource* scratch) {
+  const int D = ins.min_duration;
+  std::pmr::vector<char> counted(ins.programs.size(), 0, scratch);
+  long long bound = 0;
+  long long distinct = 0;
+
+  for (const auto& it : sub.items) {
+    const Program* p = nullptr;
+    if (it.program_ordinal >= 0) {
+      if ((size_t)it.program_ordinal < ins.programs.size()) p = ins.programs[it.program_ordinal];
+    } else {
+      auto f = ins.program_by_id.find(it.program_id);
+      if (f != ins.program_by_id.end()) p = f->second;
+    }
+    if (!p) continue;
+
+    if (!counted[p->ordinal]) {
+      counted[p->ordinal] = 1;
+      ++distinct;
+      bound += std::max(p->score, 0);
+    }
+
+    auto itg = ins.time_index.prefs_by_genre.find(p->genre);
+    if (itg == ins.time_index.prefs_by_genre.end()) continue;
+    int covered = ins.time_index.covered_minutes(p->genre, it.start, it.end);
+    if (covered >= 0 && covered < D) continue;
+    for (size_t j : itg->second) {
+      const auto& pref = ins.time_prefs[j];
+      int inter = std::min(it.end, pref.end) - std::max(it.start, pref.start);
+      if (inter >= D && pref.bonus > 0) bound += pref.bonus;
+    }
+  }
+
+  // Negative penalties are gains: at most one switch per neighbour pair,
+  // one LATE per item and one EARLY per program.
+  const long long n = (long long)sub.items.size();
+  if (ins.S < 0 && n > 1) bound += (n - 1) * -(long long)ins.S;
+  if (ins.T < 0) bound += (n + distinct) * -(long long)ins.T;
+
+  return (int)std::min<long long>(bound, std::numeric_limits<int>::max());
+}
+
+ScoreCoefficients score_coefficients(const Instance& ins,
+                                     const std::pmr::vector<TimelineItem>& sorted_tl,
+                                     std::pmr::memory_resource* scratch) {
+  const int D = ins.min_duration;
+  ScoreCoefficients c;
+  c.pref_hits.assign(ins.time_prefs.size(), 0);
+  std::pmr::vector<ProgramStats> stats(ins.programs.size(), scratch);
+
+  for (size_t i = 0; i < sorted_tl.size(); ++i) {
+    const TimelineItem& t = sorted_tl[i];
+    if (i > 0 && t.channel_id != sorted_tl[i-1].channel_id) c.switches++;
+
+    // Same test as item_bonus(), counted per preference instead of summed.
+    if (!t.genre.empty()) {
+      auto itg = ins.time_index.prefs_by_genre.find(t.genre);
+      int covered = ins.time_index.covered_minutes(t.genre, t.start, t.end);
+      if (itg != ins.time_index.prefs_by_genre.end() && (covered < 0 || covered >= D)) {
+        for (size_t j : itg->second) {
+          const auto& pref = ins.time_prefs[j];
+          int inter_len = std::max(0, std::min(t.end, pref.end) - std::max(t.start, pref.start));
+          if (inter_len >= D) c.pref_hits[j]++;
+        }
+      }
+    }
+
+    const Program* p = program_of(ins, t);
+    if (!p) continue;
+    accumulate(stats[p->ordinal], *p, t, D);
+    if (t.start > p->start) c.early_late++;
+  }
+
+  for (size_t k = 0; k < stats.size(); ++k) {
+    const auto& ps = stats[k];
+    if (!ps.seen) continue;
+    if (eligible_for_base(ps, D)) c.base += ins.programs[k]->score;
+    if (!ps.reached_end) c.early_late++;
+  }
+  return c;
+}
+
+void score_batch(const ScoreCoefficients& c, const ParamBatch& params, int* totals) {
+  const size_t n = params.size();
+  for (size_t i = 0; i < n; ++i)
+    totals[i] = c.base - c.switches * params.S[i] - c.early_late * params.T[i];
+  // One pass over the settings per preference that was earned at all.
+  for (size_t j = 0; j < c.pref_hits.size(); ++j) {
+    const int h = c.pref_hits[j];
+    if (!h) continue;
+    const int* b = params.bonus.data() + j * n;
+    for (size_t i = 0; i < n; ++i) totals[i] += h * b[i];
+  }
+}
+
+std::vector<int> marginal_deltas(const Instance& ins,
+                                 const std::pmr::vector<TimelineItem>& sorted_tl,
+                                 std::pmr::memory_resource* scratch) {
+  const int D = ins.min_duration;
+  const size_t n = sorted_tl.size();
+
+  std::pmr::vector<ProgramAirings> airings(ins.programs.size(), scratch);
+  for (const auto& t : sorted_tl)
+    if (const Program* p = program_of(ins, t)) airings[p->ordinal].add(*p, t, D);
+
+  std::vector<int> delta(n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    const TimelineItem& t = sorted_tl[i];
+    long long d = item_bonus(ins, t, D);
+
+    int switches = 0;
+    if (i > 0 && sorted_tl[i-1].channel_id != t.channel_id) switches++;
+    if (i + 1 < n && sorted_tl[i+1].channel_id != t.channel_id) switches++;
+    if (i > 0 && i + 1 < n && sorted_tl[i-1].channel_id != sorted_tl[i+1].channel_id) switches--;
+    d -= (long long)switches * ins.S;
+
+    if (const Program* p = program_of(ins, t)) {
+      const ProgramAirings& with = airings[p->ordinal];
+      ProgramAirings without = with;
+      without.add(*p, t, D, -1);
+
+      int penalized = (t.start > p->start ? 1 : 0) + with.early() - without.early();
+      d += with.base(*p, D) - without.base(*p, D);
+      d -= (long long)penalized * ins.T;
+    }
+    delta[i] = (int)d;
+  }
+  return delta;
+}
+
+EvalOutput evaluate_parallel(const Instance& ins,
+                             const std::pmr::vector<TimelineItem>& sorted_tl,
+                             ThreadPool& pool, size_t shards,
+                             std::pmr::memory_resource* scratch, Interrupt* stop) {
+  const size_t n = sorted_tl.size();
+  const size_t P = ins.programs.size();
+  if (shards == 0) shards = (size_t)pool.concurrency() * 4;
+  shards = std::min(shards, n / kParallelEvalMinShardItems);
+  // Each shard keeps a table of all P programs: bound the tables, and the
+  // merge that reads them, by the timeline rather than the catalog.
+  shards = std::min(shards, n / (kParallelEvalItemsPerStat * std::max<size_t>(P, 1)));
+  if (shards <= 1) return evaluate(ins, sorted_tl, false, scratch, stop);
+  EvalOutput out;
+  auto stopped = [&]{ return stop && (out.interrupted = stop->check()); };
+
+  const int D = ins.min_duration;
+  const bool has_prefs = !ins.time_prefs.empty();
+
+  // Partial summary of one time shard. Additive fields merge by sum, the
+  // per-program flags by OR; switches are counted against the previous item
+  // even across the shard boundary, so each neighbour pair is seen once.
+  struct Partial {
+    std::pmr::vector<ProgramStats> stats;
+    long long bonuses = 0, late = 0, switches = 0;
+  };
+  std::pmr::vector<Partial> parts(scratch);
+  parts.reserve(shards);
+  for (size_t k = 0; k < shards; ++k)
+    parts.push_back(Partial{std::pmr::vector<ProgramStats>(P, scratch)});
+
+  // Interrupt is not shared across threads: each shard polls its own copy,
+  // and the first to trip stops the others through `halted`.
+  std::atomic<bool> halted{false};
+  pool.parallel_for(shards, [&](size_t k) {
+    TraceSpan span("evaluate shard");
+    Partial& part = parts[k];
+    std::optional<Interrupt> local;
+    if (stop) local.emplace(*stop);
+    const size_t lo = n * k / shards, hi = n * (k + 1) / shards;
+    for (size_t i = lo; i < hi; ++i) {
+      if (local && local->poll()) halted.store(true, std::memory_order_relaxed);
+      if (halted.load(std::memory_order_relaxed)) return;
+      const TimelineItem& item = sorted_tl[i];
+      if (i > 0 && item.channel_id != sorted_tl[i-1].channel_id) part.switches++;
+      if (has_prefs) part.bonuses += item_bonus(ins, item, D);
+      const Program* p = program_of(ins, item);
+      if (!p) continue;
+      accumulate(part.stats[p->ordinal], *p, item, D);
+      if (item.start > p->start) part.late++;
+    }
+  });
+
+  if (halted.load()) {
+    stop->check();  // records the reason the shard saw
+    out.interrupted = true;
+    return out;
+  }
+  if (stopped()) return out;
+
+  // Programs split across shards: merge flags per ordinal, in chunks.
+  const size_t chunks = std::min<size_t>(shards, std::max<size_t>(1, P / 1024));
+  std::pmr::vector<long long> chunk_base(chunks, 0, scratch), chunk_early(chunks, 0, scratch);
+  pool.parallel_for(chunks, [&](size_t c) {
+    TraceSpan span("evaluate merge");
+    const size_t lo = P * c / chunks, hi = P * (c + 1) / chunks;
+    for (size_t k = lo; k < hi; ++k) {
+      ProgramStats m;
+      for (const Partial& part : parts) {
+        const ProgramStats& ps = part.stats[k];
+        if (!ps.seen) continue;
+        m.seen = true;
+        m.full_length = ps.full_length;
+        m.has_long_segment |= ps.has_long_segment;
+        m.has_full_short   |= ps.has_full_short;
+        m.reached_end      |= ps.reached_end;
+      }
+      if (!m.seen) continue;
+      if (eligible_for_base(m, D)) chunk_base[c] += ins.programs[k]->score;
+      if (!m.reached_end) chunk_early[c]++;
+    }
+  });
+
+  if (stopped()) return out;
+
+  long long base = 0, early = 0, bonuses = 0, late = 0, switches = 0;
+  for (size_t c = 0; c < chunks; ++c) { base += chunk_base[c]; early += chunk_early[c]; }
+  for (const Partial& part : parts) {
+    bonuses += part.bonuses; late += part.late; switches += part.switches;
+  }
 
+  out.base     = (int)base;
+  out.bonuses  = (int)bonuses;
+  out.switches = (int)switches;
+  out.late     = (int)late;
+  out.early    = (int)early;
+  out.total = out.base + out.bonuses - out.switches * ins.S - (out.late + out.early) * ins.T;
   return out;
 }
 
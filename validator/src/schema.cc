@@ -0,0 +1,397 @@
+#include "schema.hh"
+#include <string>
+#include <utility>
+
+namespace tvv {
+
+using Check = SchemaError::Check;
+
+void SchemaErrors::add(Check check, std::string path, std::string message) {
+  if (!wants(check)) return;
+  seen_ |= 1u << (unsigned)check;
+  errors_.push_back(SchemaError{check, std::move(path), std::move(message)});
+}
+
+std::string error_message(const SchemaError& e) {
+  switch (e.check) {
+    case Check::InputStructure:   return "Input structure validation failed: " + e.message;
+    case Check::OutputStructure:  return "Output structure validation failed: " + e.message;
+    case Check::InputConstraints: return "Input validation failed: " + e.message;
+    case Check::References:       return "Output validation failed: " + e.message;
+    case Check::ProgramChannel:   return "Program and channel validation failed: " + e.message;
+    case Check::InputBuild:
+    case Check::OutputBuild:      break;
+  }
+  return "Parsing to structs failed: " + e.message;
+}
+
+const SchemaError* SchemaErrors::first() const {
+  const SchemaError* best = nullptr;
+  for (const auto& e : errors_)
+    if (!best || e.check < best->check) best = &e;
+  return best;
+}
+
+namespace {
+
+void append(std::string& s, const char* key) { s += key; }
+void append(std::string& s, size_t index) { s += std::to_string(index); }
+
+// pointer("channels", 2, "programs") is "/channels/2/programs". The keys
+// used here never need RFC 6901 escaping.
+template <class... Parts>
+std::string pointer(const Parts&... parts) {
+  std::string s;
+  ((s += '/', append(s, parts)), ...);
+  return s;
+}
+
+// One lookup per field, instead of contains() followed by operator[].
+const Document* member(const Document& obj, const char* key) {
+  if (!obj.is_object()) return nullptr;
+  auto it = obj.find(key);
+  return it == obj.end() ? nullptr : &*it;
+}
+
+// What get<int>() converts.
+bool converts_to_int(const Document& v) { return v.is_number() || v.is_boolean(); }
+
+// The error texts of build_instance() and build_submission(), so a
+// build error reads the same whether the schema pass or the parser found it.
+std::string missing_int(const char* key) { return std::string("Missing/int field: ") + key; }
+std::string type_must_be(const char* type, const Document& v) {
+  return std::string("[json.exception.type_error.302] type must be ") + type + ", but is " + v.type_name();
+}
+
+// Path of a list element during the walk: a chain of the enclosing
+// steps, spelled out as a pointer only when an error is recorded, so a
+// clean document costs no string per element.
+struct Path {
+  const Path* parent = nullptr;
+  std::string_view key;  // a member name; null data() for an array index
+  size_t index = 0;
+
+  std::string str() const {
+    std::string s = parent ? parent->str() : std::string();
+    s += '/';
+    if (key.data()) s += key;
+    else s += std::to_string(index);
+    return s;
+  }
+  Path operator/(std::string_view k) const { return Path{this, k, 0}; }
+  Path operator/(size_t i) const { return Path{this, {}, i}; }
+};
+
+// Reads `key` of a priority block or time preference as a time: a missing
+// or non-numeric one is a constraint error, a non-integer one a build error.
+bool read_time(const Document& obj, const char* key, const char* what, const Path& at,
+               SchemaErrors& errors, int& out) {
+  const Document* f = member(obj, key);
+  if (!f || !converts_to_int(*f)) {
+    errors.add(Check::InputConstraints, (at / key).str(), std::string(what) + " " + key + " must be a number.");
+    return false;
+  }
+  out = f->get<int>();
+  if (!f->is_number_integer()) errors.add(Check::InputBuild, (at / key).str(), missing_int(key));
+  return true;
+}
+
+// Calls f(element, path) for each element of `v` the way a range-for over
+// it does, which is how build_instance() reads these lists: null is empty,
+// an object yields its values and any other scalar itself.
+template <class F>
+void for_each_element(const Document& v, const Path& path, F&& f) {
+  if (v.is_array()) {
+    for (size_t i = 0; i < v.size(); ++i) f(v[i], path / i);
+  } else if (v.is_object()) {
+    for (auto it = v.begin(); it != v.end(); ++it) f(it.value(), path / std::string_view(it.key()));
+  } else if (!v.is_null()) {
+    f(v, path);
+  }
+}
+
+// Whether the channel at position `c` lists program `id`, given that the
+// first channel listing it is at `first`.
+bool listed(const CatalogIndex& index, size_t first, size_t c, std::string_view id) {
+  if (first == c) return true;
+  if (!index.shared_ids) return false;
+  auto [lo, hi] = index.also_listed.equal_range(id);
+  for (; lo != hi; ++lo)
+    if (lo->second == c) return true;
+  return false;
+}
+
+} // namespace
+
+void check_instance(const Document& j, SchemaErrors& errors, CatalogIndex& index) {
+  if (!j.is_object()) {
+    errors.add(Check::InputStructure, "", "Instance must be a JSON object.");
+    return;
+  }
+
+  static const char* const kRequired[] = {
+    "opening_time", "closing_time", "min_duration", "max_consecutive_genre",
+    "channels_count", "switch_penalty", "termination_penalty", "priority_blocks",
+    "time_preferences", "channels"
+  };
+  for (const char* field : kRequired)
+    if (!member(j, field))
+      errors.add(Check::InputStructure, pointer(field),
+                 std::string("Missing required field ") + field + " in input file.");
+
+  // Fields are visited in build_instance() order, so the first build error
+  // is the one it would throw.
+  auto window_end = [&](const char* key, int& out) {
+    const Document* f = member(j, key);
+    if (!f) return false;
+    if (!converts_to_int(*f)) {
+      errors.add(Check::InputConstraints, pointer(key), std::string(key) + " must be a number.");
+      return false;
+    }
+    out = f->get<int>();
+    if (!f->is_number_integer()) errors.add(Check::InputBuild, pointer(key), missing_int(key));
+    return true;
+  };
+  int O = 0, E = 0;
+  bool window = window_end("opening_time", O);
+  window &= window_end("closing_time", E);
+  if (window && O >= E)
+    errors.add(Check::InputConstraints, pointer("opening_time"),
+               "Opening time cannot be greater than or equal to closing time.");
+
+  for (const char* key : {"min_duration", "max_consecutive_genre", "switch_penalty", "termination_penalty"})
+    if (const Document* f = member(j, key); f && !converts_to_int(*f))
+      errors.add(Check::InputBuild, pointer(key), type_must_be("number", *f));
+
+  int channels_count = 0;
+  bool have_count = false;
+  if (const Document* f = member(j, "channels_count")) {
+    if (converts_to_int(*f)) {
+      channels_count = f->get<int>();
+      have_count = true;
+    } else {
+      errors.add(Check::InputConstraints, pointer("channels_count"), "channels_count must be a number.");
+    }
+  }
+
+  const Document* channels = member(j, "channels");
+  if (channels && !channels->is_array()) {
+    errors.add(Check::InputConstraints, pointer("channels"), "channels must be an array.");
+  } else if (channels) {
+    if (have_count && channels_count != (int)channels->size())
+      errors.add(Check::InputConstraints, pointer("channels_count"),
+                 "Channels count mismatch. Expected " + std::to_string(channels_count) +
+                 ", but found " + std::to_string(channels->size()) + ".");
+
+    for (size_t c = 0; c < channels->size(); ++c) {
+      const Document& ch = (*channels)[c];
+      const Document* cid = member(ch, "channel_id");
+      if (!cid || !cid->is_number_integer()) cid = member(ch, "id");
+      if (cid && cid->is_number_integer())
+        index.channel.emplace(cid->get<int>(), c);
+      else
+        errors.add(Check::InputBuild, pointer("channels", c, "channel_id"),
+                   "Missing/int field: channel_id (or id)");
+
+      const Document* programs = member(ch, "programs");
+      if (!programs || !programs->is_array()) {
+        errors.add(Check::InputBuild, pointer("channels", c, "programs"), "Missing/array: channels[].programs");
+        continue;
+      }
+      for (size_t k = 0; k < programs->size(); ++k) {
+        const Document& p = (*programs)[k];
+        const Document* pid = member(p, "program_id");
+        if (pid && pid->is_string()) {
+          auto [at, fresh] = index.program.emplace(pid->get_ref<const std::string&>(), c);
+          if (!fresh && at->second != c) {
+            index.shared_ids = true;
+            index.also_listed.emplace(at->first, c);
+          }
+        } else {
+          errors.add(Check::InputBuild, pointer("channels", c, "programs", k, "program_id"),
+                     "Missing/string field: program_id");
+        }
+        for (const char* key : {"start", "end"}) {
+          const Document* f = member(p, key);
+          if (!f || !f->is_number_integer())
+            errors.add(Check::InputBuild, pointer("channels", c, "programs", k, key), missing_int(key));
+        }
+        if (const Document* f = member(p, "genre"); f && !f->is_string())
+          errors.add(Check::InputBuild, pointer("channels", c, "programs", k, "genre"), type_must_be("string", *f));
+        if (const Document* f = member(p, "score"); f && !converts_to_int(*f))
+          errors.add(Check::InputBuild, pointer("channels", c, "programs", k, "score"), type_must_be("number", *f));
+      }
+    }
+  }
+
+  if (const Document* blocks = member(j, "priority_blocks")) {
+    for_each_element(*blocks, Path{nullptr, "priority_blocks"}, [&](const Document& block, const Path& at) {
+      int start = 0, end = 0;
+      bool times = read_time(block, "start", "Priority block", at, errors, start);
+      times &= read_time(block, "end", "Priority block", at, errors, end);
+      if (times && window && (start < O || end > E))
+        errors.add(Check::InputConstraints, at.str(),
+                   "Priority block " + std::to_string(start) + "-" + std::to_string(end) +
+                   " is out of valid time range [" + std::to_string(O) + ", " + std::to_string(E) + "].");
+
+      const Document* allowed = member(block, "allowed_channels");
+      if (!allowed) return;
+      for_each_element(*allowed, at / "allowed_channels", [&](const Document& ac, const Path& ac_at) {
+        // Compared as JSON, null and booleans order before every number and
+        // strings and containers after, so no non-number is ever in range.
+        if (!ac.is_number()) {
+          errors.add(Check::InputConstraints, ac_at.str(),
+                     "Invalid channel " + ac.dump(-1, ' ', false, Document::error_handler_t::replace) +
+                     " in priority block.");
+          return;
+        }
+        const int id = ac.get<int>();
+        if (have_count && (id < 0 || id >= channels_count))
+          errors.add(Check::InputConstraints, ac_at.str(), "Invalid channel " + std::to_string(id) + " in priority block.");
+      });
+    });
+  }
+
+  if (const Document* prefs = member(j, "time_preferences")) {
+    for_each_element(*prefs, Path{nullptr, "time_preferences"}, [&](const Document& pref, const Path& at) {
+      int start = 0, end = 0;
+      bool times = read_time(pref, "start", "Time preference", at, errors, start);
+      times &= read_time(pref, "end", "Time preference", at, errors, end);
+      if (times && window && (start < O || end > E))
+        errors.add(Check::InputConstraints, at.str(),
+                   "Time preference " + std::to_string(start) + "-" + std::to_string(end) +
+                   " is out of valid time range [" + std::to_string(O) + ", " + std::to_string(E) + "].");
+
+      const Document* genre = member(pref, "preferred_genre");
+      if (!genre || !genre->is_string() || genre->get_ref<const std::string&>().empty())
+        errors.add(Check::InputConstraints, (at / "preferred_genre").str(), "Preferred genre is empty or invalid.");
+      if (const Document* f = member(pref, "bonus"); f && !converts_to_int(*f))
+        errors.add(Check::InputBuild, (at / "bonus").str(), type_must_be("number", *f));
+    });
+  }
+}
+
+void check_submission(const Document& j, const CatalogIndex* index, SchemaErrors& errors,
+                      Submission& out) {
+  const Document* items = member(j, "scheduled_programs");
+  if (!items) {
+    errors.add(Check::OutputStructure, pointer("scheduled_programs"),
+               "Missing 'scheduled_programs' in output file.");
+    return;
+  }
+  if (!items->is_array()) {
+    errors.add(Check::OutputStructure, pointer("scheduled_programs"),
+               "'scheduled_programs' should be an array.");
+    return;
+  }
+
+  // Channel of the first item scheduling each id. Only consulted when the
+  // catalog lists an id under several channels; otherwise "the channel
+  // lists the program" already pins every airing of it to one channel.
+  std::pmr::unordered_map<std::string_view, int> first_channel(scratch_or_default());
+
+  out.items.clear();
+  out.items.resize(items->size());
+  for (size_t i = 0; i < items->size(); ++i) {
+    const Document& it = (*items)[i];
+    SubmissionItem& si = out.items[i];
+    if (!it.is_object()) {
+      errors.add(Check::OutputStructure, pointer("scheduled_programs", i), "Scheduled program must be an object.");
+      continue;
+    }
+
+    const Document* pid = member(it, "program_id");
+    if (pid && pid->is_string()) {
+      si.program_id = pid->get_ref<const std::string&>();
+    } else {
+      errors.add(Check::References, pointer("scheduled_programs", i, "program_id"),
+                 "program_id must be a string.");
+      pid = nullptr;
+    }
+    const Document* cid = member(it, "channel_id");
+    if (cid && converts_to_int(*cid)) {
+      si.channel_id = cid->get<int>();
+      if (!cid->is_number_integer())
+        errors.add(Check::OutputBuild, pointer("scheduled_programs", i, "channel_id"), missing_int("channel_id"));
+    } else {
+      errors.add(Check::ProgramChannel, pointer("scheduled_programs", i, "channel_id"),
+                 "channel_id must be a number.");
+      cid = nullptr;
+    }
+    for (auto [key, dst] : {std::pair<const char*, int*>{"start", &si.start}, {"end", &si.end}}) {
+      const Document* f = member(it, key);
+      if (f && f->is_number_integer()) *dst = f->get<int>();
+      else errors.add(Check::OutputBuild, pointer("scheduled_programs", i, key), missing_int(key));
+    }
+
+    if (!index || !pid) continue;
+    const std::string& id = pid->get_ref<const std::string&>();
+    auto p = index->program.find(id);
+    if (p == index->program.end() && errors.wants(Check::References))
+      errors.add(Check::References, pointer("scheduled_programs", i, "program_id"),
+                 "Program " + id + " in output file does not exist in input file.");
+    if (!cid) continue;
+
+    const int ch = si.channel_id;
+    auto c = index->channel.find(ch);
+    if (c == index->channel.end()) {
+      if (errors.wants(Check::ProgramChannel))
+        errors.add(Check::ProgramChannel, pointer("scheduled_programs", i, "channel_id"),
+                   "Channel ID " + std::to_string(ch) + " in output file does not exist in input file.");
+    } else if (p == index->program.end()) {
+      // Already reported as unknown.
+    } else if (!listed(*index, p->second, c->second, id)) {
+      if (errors.wants(Check::ProgramChannel))
+        errors.add(Check::ProgramChannel, pointer("scheduled_programs", i, "channel_id"),
+                   "Program ID " + id + " does not belong to Channel " + std::to_string(ch) + " in input file.");
+    } else if (index->shared_ids) {
+      auto [first, fresh] = first_channel.emplace(pid->get_ref<const std::string&>(), ch);
+      if (!fresh && first->second != ch && errors.wants(Check::ProgramChannel))
+        errors.add(Check::ProgramChannel, pointer("scheduled_programs", i, "channel_id"),
+                   "Program ID " + id + " is scheduled in channel " + std::to_string(first->second) +
+                   " in output file, but it should be in channel " + std::to_string(ch) +
+                   " based on the input file.");
+    }
+  }
+
+  // As the original parser did, a "schedule" array is what gets scored when
+  // present; only scheduled_programs is checked against the catalog.
+  if (const Document* schedule = member(j, "schedule"); schedule && schedule->is_array()) {
+    std::string error;
+    if (!build_submission(j, out, error)) errors.add(Check::OutputBuild, pointer("schedule"), error);
+  }
+}
+
+const Program* check_item_references(const Instance& ins, const SubmissionItem& it, size_t index,
+                                     SchemaErrors& errors) {
+  const Program* p = nullptr;
+  if (it.program_ordinal >= 0) {
+    if ((size_t)it.program_ordinal < ins.programs.size()) p = ins.programs[it.program_ordinal];
+  } else {
+    auto f = ins.program_by_id.find(it.program_id);
+    if (f != ins.program_by_id.end()) p = f->second;
+  }
+  if (!p) {
+    if (errors.wants(Check::References))
+      errors.add(Check::References, pointer("scheduled_programs", index, "program_id"),
+                 it.program_ordinal >= 0
+                   ? "Program ordinal " + std::to_string(it.program_ordinal) + " does not exist in input file."
+                   : "Program " + std::string(it.program_id) + " in output file does not exist in input file.");
+    return nullptr;
+  }
+
+  auto c = ins.channel_by_id.find(it.channel_id);
+  if (c == ins.channel_by_id.end()) {
+    if (errors.wants(Check::ProgramChannel))
+      errors.add(Check::ProgramChannel, pointer("scheduled_programs", index, "channel_id"),
+                 "Channel ID " + std::to_string(it.channel_id) + " in output file does not exist in input file.");
+  } else if (const auto& progs = c->second->programs; p < progs.data() || p >= progs.data() + progs.size()) {
+    if (errors.wants(Check::ProgramChannel))
+      errors.add(Check::ProgramChannel, pointer("scheduled_programs", index, "channel_id"),
+                 "Program ID " + std::string(p->id) + " does not belong to Channel " + std::to_string(it.channel_id) +
+                 " in input file.");
+  }
+  return p;
+}
+
+} // namespace tvv
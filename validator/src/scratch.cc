@@ -0,0 +1,41 @@
+#include "scratch.hh"
+#include <algorithm>
+#include <cstring>
+
+namespace tvv {
+
+ScratchArena::ScratchArena(size_t initial_bytes)
+  : buffer_(new std::byte[std::max<size_t>(initial_bytes, 1024)]),
+    capacity_(std::max<size_t>(initial_bytes, 1024)) {
+  mono_.emplace(buffer_.get(), capacity_, std::pmr::new_delete_resource());
+}
+
+void* ScratchArena::do_allocate(size_t bytes, size_t align) {
+  used_ += bytes + align - 1;
+  return mono_->allocate(bytes, align);
+}
+
+void ScratchArena::reset() {
+  mono_.reset();
+  if (used_ > capacity_) {
+    capacity_ = used_ + used_ / 4;
+    buffer_.reset(new std::byte[capacity_]);
+  }
+  used_ = 0;
+  mono_.emplace(buffer_.get(), capacity_, std::pmr::new_delete_resource());
+}
+
+std::string_view StringPool::intern(std::string_view s) {
+  auto it = index_.find(s);
+  if (it != index_.end()) return *it;
+  return *index_.insert(copy(s)).first;
+}
+
+std::string_view StringPool::copy(std::string_view s) {
+  char* p = static_cast<char*>(chunks_.allocate(s.size() + 1, 1));
+  if (!s.empty()) std::memcpy(p, s.data(), s.size());
+  p[s.size()] = '\0';
+  return std::string_view(p, s.size());
+}
+
+} // namespace tvv
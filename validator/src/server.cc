@@ -0,0 +1,467 @@
+#include "server.hh"
+#include "hash.hh"
+#include "result_cache.hh"
+#include "thread_pool.hh"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace tvv {
+
+std::shared_ptr<const PreparedInstance> InstanceCache::find(std::uint64_t key) {
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = index_.find(key);
+  if (it == index_.end()) return nullptr;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+std::shared_ptr<const PreparedInstance> InstanceCache::insert(std::uint64_t key,
+                                                              std::shared_ptr<const PreparedInstance> pi) {
+  std::shared_ptr<const PreparedInstance> evicted;  // released after unlocking
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->second;
+  }
+  if (lru_.size() >= capacity_) {
+    evicted = std::move(lru_.back().second);
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  lru_.emplace_front(key, pi);
+  index_[key] = lru_.begin();
+  return pi;
+}
+
+std::shared_ptr<const PreparedInstance> InstanceCache::get_or_prepare(std::string_view text,
+                                                                      std::uint64_t* key_out,
+                                                                      ThreadPool* pool) {
+  const std::uint64_t key = hash_bytes(text);
+  if (key_out) *key_out = key;
+  // hash_bytes() collisions can be crafted, so an entry counts only if it
+  // was built from the same text; another one under the key is never
+  // replaced, or clients holding its hash would get the wrong instance.
+  const std::uint64_t check = keyed_hash(process_hash_key(), text);
+  if (auto hit = find(key)) return hit->content_check == check ? hit : nullptr;
+  // Two requests missing on the same text may both prepare it; the first
+  // insert wins and both results are equivalent.
+  auto kept = insert(key, prepare_instance(text, pool));
+  return kept->content_check == check ? kept : nullptr;
+}
+
+size_t InstanceCache::size() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return lru_.size();
+}
+
+std::string hash_to_hex(std::uint64_t h) {
+  char buf[17];
+  std::snprintf(buf, sizeof buf, "%016llx", (unsigned long long)h);
+  return buf;
+}
+
+namespace {
+
+constexpr size_t kMaxHeaderLine = 256;
+
+class SocketReader {
+public:
+  explicit SocketReader(int fd) : fd_(fd) {}
+
+  // Reads up to '\n' (dropped). False on EOF, error or an overlong line.
+  bool read_line(std::string& out) {
+    out.clear();
+    for (;;) {
+      if (pos_ == len_ && !fill()) return false;
+      char c = buf_[pos_++];
+      if (c == '\n') return true;
+      if (out.size() >= kMaxHeaderLine) return false;
+      out.push_back(c);
+    }
+  }
+
+  // Grows `out` as bytes arrive, so a header alone reserves nothing.
+  bool read_exact(std::string& out, size_t n) {
+    out.clear();
+    while (out.size() < n) {
+      if (pos_ == len_ && !fill()) return false;
+      size_t k = std::min(n - out.size(), len_ - pos_);
+      out.append(buf_ + pos_, k);
+      pos_ += k;
+    }
+    return true;
+  }
+
+private:
+  bool fill() {
+    for (;;) {
+      ssize_t r = ::read(fd_, buf_, sizeof buf_);
+      if (r > 0) { pos_ = 0; len_ = (size_t)r; return true; }
+      if (r < 0 && errno == EINTR) continue;
+      return false;
+    }
+  }
+
+  int fd_;
+  char buf_[64 * 1024];
+  size_t pos_ = 0, len_ = 0;
+};
+
+bool write_all(int fd, const char* p, size_t n) {
+  while (n > 0) {
+    ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return false;
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+bool parse_size(const std::string& s, size_t& out) {
+  if (s.empty() || s.size() > 12) return false;
+  size_t v = 0;
+  for (char c : s) {
+    if (c < '0' || c > '9') return false;
+    v = v * 10 + size_t(c - '0');
+  }
+  out = v;
+  return true;
+}
+
+bool parse_hex(const std::string& s, std::uint64_t& out) {
+  if (s.empty() || s.size() > 16) return false;
+  std::uint64_t v = 0;
+  for (char c : s) {
+    int d = (c >= '0' && c <= '9') ? c - '0'
+          : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+          : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+    if (d < 0) return false;
+    v = (v << 4) | std::uint64_t(d);
+  }
+  out = v;
+  return true;
+}
+
+// One response slot, filled by a pool task and written in request order.
+struct Pending {
+  std::mutex mu;
+  std::condition_variable cv;
+  bool done = false;
+  std::string frame;
+
+  void finish(bool ok, long long latency_us, const std::string& body) {
+    std::string f = ok ? "OK " : "ERR ";
+    f += std::to_string(latency_us);
+    f += ' ';
+    f += std::to_string(body.size());
+    f += '\n';
+    f += body;
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      frame = std::move(f);
+      done = true;
+    }
+    cv.notify_one();
+  }
+};
+
+struct Request {
+  enum class Kind { Load, Validate } kind;
+  bool by_hash = false;
+  std::uint64_t hash = 0;
+  std::string instance;
+  std::string submission;
+  bool verbose = false;
+};
+
+// Header and payload of the next request; false ends the connection.
+bool read_request(SocketReader& in, size_t max_payload, Request& req, std::string& err) {
+  std::string line;
+  if (!in.read_line(line)) return false;
+  std::istringstream hs(line);
+  std::string cmd, a, b, c;
+  hs >> cmd >> a >> b >> c;
+
+  auto too_large = [&](size_t n) {
+    if (n <= max_payload) return false;
+    err = "payload over " + std::to_string(max_payload) + " bytes";
+    return true;
+  };
+  size_t n = 0, m = 0;
+  if (cmd == "LOAD") {
+    req.kind = Request::Kind::Load;
+    if (!parse_size(a, n)) { err = "bad LOAD header"; return false; }
+    if (too_large(n)) return false;
+    return in.read_exact(req.instance, n);
+  }
+  if (cmd == "VALIDATE") {
+    req.kind = Request::Kind::Validate;
+    req.verbose = (c == "verbose");
+    if (!parse_size(b, m)) { err = "bad VALIDATE header"; return false; }
+    if (too_large(m)) return false;
+    if (!a.empty() && a[0] == '#') {
+      req.by_hash = true;
+      if (!parse_hex(a.substr(1), req.hash)) { err = "bad instance hash"; return false; }
+    } else if (!parse_size(a, n)) {
+      err = "bad VALIDATE header";
+      return false;
+    } else if (too_large(n) || !in.read_exact(req.instance, n)) {
+      return false;
+    }
+    return in.read_exact(req.submission, m);
+  }
+  err = "unknown command";
+  return false;
+}
+
+void run_request(Request& req, Pending& out, ThreadPool& pool, InstanceCache& cache,
+                 ResultCache* memo) {
+  using clock = std::chrono::steady_clock;
+  const auto t0 = clock::now();
+  auto latency = [&]{
+    return (long long)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - t0).count();
+  };
+
+  std::uint64_t key = req.hash;
+  std::shared_ptr<const PreparedInstance> pi =
+    req.by_hash ? cache.find(key) : cache.get_or_prepare(req.instance, &key, &pool);
+  if (!pi) {
+    out.finish(false, latency(), req.by_hash ? "unknown instance " + hash_to_hex(key)
+                                             : "instance hash collides with a cached instance");
+    return;
+  }
+  if (req.kind == Request::Kind::Load) {
+    out.finish(true, latency(), "{\"instance\":\"" + hash_to_hex(key) + "\"}");
+    return;
+  }
+
+  thread_local ScratchArena arena;
+  ValidateOptions opts;
+  opts.verbose = req.verbose;
+  opts.arena = &arena;
+  opts.pool = &pool;  // large timelines only; see cmd_batch
+  opts.memo = memo;
+  std::string body = validate_to_json(*pi, req.submission, opts);
+  arena.reset();
+  out.finish(true, latency(), body);
+}
+
+void serve_connection(int fd, size_t max_payload, size_t max_pending, ThreadPool& pool,
+                      InstanceCache& cache, ResultCache* memo) {
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<std::shared_ptr<Pending>> queue;
+  bool closed = false;
+
+  // A request leaves the queue once its response is written, so the queue
+  // holds every request of this connection still in flight.
+  std::thread writer([&]{
+    bool ok = true;
+    for (;;) {
+      std::shared_ptr<Pending> p;
+      {
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&]{ return closed || !queue.empty(); });
+        if (queue.empty()) return;
+        p = queue.front();
+      }
+      {
+        std::unique_lock<std::mutex> lk(p->mu);
+        p->cv.wait(lk, [&]{ return p->done; });
+      }
+      if (ok) ok = write_all(fd, p->frame.data(), p->frame.size());
+      { std::lock_guard<std::mutex> lk(mu); queue.pop_front(); }
+      cv.notify_all();
+    }
+  });
+
+  auto push = [&](std::shared_ptr<Pending> p) {
+    { std::lock_guard<std::mutex> lk(mu); queue.push_back(std::move(p)); }
+    cv.notify_all();
+  };
+
+  SocketReader in(fd);
+  for (;;) {
+    {
+      // At the bound, stop reading until the writer drains a response, so
+      // a client that never reads cannot pile up work and payloads.
+      std::unique_lock<std::mutex> lk(mu);
+      cv.wait(lk, [&]{ return queue.size() < max_pending; });
+    }
+    auto req = std::make_shared<Request>();
+    std::string err;
+    if (!read_request(in, max_payload, *req, err)) {
+      if (!err.empty()) {
+        auto p = std::make_shared<Pending>();
+        p->finish(false, 0, err);
+        push(p);
+      }
+      break;
+    }
+    auto p = std::make_shared<Pending>();
+    push(p);
+    pool.submit([req, p, &pool, &cache, memo]{ run_request(*req, *p, pool, cache, memo); });
+  }
+
+  { std::lock_guard<std::mutex> lk(mu); closed = true; }
+  cv.notify_one();
+  writer.join();
+  // The client sees EOF now; Connections closes fd once this thread is joined.
+  ::shutdown(fd, SHUT_RDWR);
+}
+
+// Clears the way for bind(): removes a socket left behind by a server that
+// is gone. A live server's socket, or a path that is not a socket, is kept
+// and reported as EADDRINUSE.
+bool claim_socket_path(const sockaddr_un& addr) {
+  struct stat st;
+  if (::lstat(addr.sun_path, &st) < 0) return errno == ENOENT;
+  if (!S_ISSOCK(st.st_mode)) { errno = EADDRINUSE; return false; }
+  int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe < 0) return false;
+  const bool live = ::connect(probe, (const sockaddr*)&addr, sizeof addr) == 0;
+  ::close(probe);
+  if (live) { errno = EADDRINUSE; return false; }
+  return ::unlink(addr.sun_path) == 0 || errno == ENOENT;
+}
+
+// The connection threads, at most `limit` at a time. Each one is joined by
+// the accept loop once it reports itself finished.
+class Connections {
+public:
+  explicit Connections(size_t limit) : limit_(limit ? limit : 1) {}
+  ~Connections() { close_all(); }
+
+  // Joins finished threads, then waits for a free slot.
+  void wait_for_slot() {
+    std::unique_lock<std::mutex> lk(mu_);
+    for (;;) {
+      reap(lk);
+      if (running_.size() < limit_) return;
+      cv_.wait(lk, [&]{ return !finished_.empty(); });
+    }
+  }
+
+  template <typename Fn>
+  void start(int fd, Fn fn) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = running_.emplace(running_.end());
+    it->fd = fd;
+    // The thread cannot report before this assignment: it needs mu_.
+    it->thread = std::thread([this, it, fn]{
+      fn();
+      std::lock_guard<std::mutex> done(mu_);
+      finished_.push_back(it);
+      cv_.notify_one();
+    });
+  }
+
+  // Ends every connection: their reads fail, their queued work drains and
+  // their threads are joined.
+  void close_all() {
+    std::unique_lock<std::mutex> lk(mu_);
+    for (Connection& c : running_) ::shutdown(c.fd, SHUT_RDWR);
+    cv_.wait(lk, [&]{ return finished_.size() == running_.size(); });
+    reap(lk);
+  }
+
+private:
+  struct Connection {
+    std::thread thread;
+    int fd = -1;
+  };
+
+  void reap(std::unique_lock<std::mutex>& lk) {
+    std::vector<std::list<Connection>::iterator> done;
+    done.swap(finished_);
+    lk.unlock();
+    for (auto it : done) {
+      it->thread.join();
+      ::close(it->fd);
+    }
+    lk.lock();
+    for (auto it : done) running_.erase(it);
+  }
+
+  const size_t limit_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::list<Connection> running_;
+  std::vector<std::list<Connection>::iterator> finished_;
+};
+
+} // namespace
+
+int serve(const ServerOptions& opts) {
+  std::signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (opts.socket_path.empty() || opts.socket_path.size() >= sizeof addr.sun_path) {
+    std::cerr << "tvv: bad socket path '" << opts.socket_path << "'\n";
+    return 1;
+  }
+  std::memcpy(addr.sun_path, opts.socket_path.c_str(), opts.socket_path.size() + 1);
+
+  int lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (lfd < 0) {
+    std::cerr << "tvv: socket: " << std::strerror(errno) << "\n";
+    return 1;
+  }
+  if (!claim_socket_path(addr) ||
+      ::bind(lfd, (sockaddr*)&addr, sizeof addr) < 0 || ::listen(lfd, 64) < 0) {
+    std::cerr << "tvv: " << opts.socket_path << ": " << std::strerror(errno) << "\n";
+    ::close(lfd);
+    return 1;
+  }
+
+  // Connection threads only read and write, so every pool thread is a
+  // worker; the pool counts its caller, which never runs submitted tasks.
+  const unsigned workers = opts.threads ? opts.threads
+                                        : std::max(1u, std::thread::hardware_concurrency());
+  ThreadPool pool(workers + 1);
+  InstanceCache cache(opts.cache_capacity);
+  std::optional<ResultCache> memo;
+  if (opts.result_cache_bytes) memo.emplace(opts.result_cache_bytes);
+  std::cerr << "tvv: listening on " << opts.socket_path << " (" << workers
+            << " workers, cache " << opts.cache_capacity << ", up to "
+            << opts.max_connections << " connections)\n";
+
+  // Declared after what the handlers use, so it is joined before those go.
+  Connections connections(opts.max_connections);
+  for (;;) {
+    connections.wait_for_slot();
+    int fd = ::accept(lfd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      std::cerr << "tvv: accept: " << std::strerror(errno) << "\n";
+      ::close(lfd);
+      return 1;
+    }
+    ResultCache* m = memo ? &*memo : nullptr;
+    const size_t max_payload = opts.max_payload;
+    const size_t max_pending = std::max<size_t>(opts.max_pending, 1);
+    connections.start(fd, [fd, max_payload, max_pending, &pool, &cache, m]{
+      serve_connection(fd, max_payload, max_pending, pool, cache, m);
+    });
+  }
+}
+
+} // namespace tvv
@@ -0,0 +1,217 @@
+#include "stream.hh"
+#include <algorithm>
+
+namespace tvv {
+
+StreamValidator::StreamValidator(std::shared_ptr<const PreparedInstance> prepared)
+    : prepared_(std::move(prepared)) {
+  if (!prepared_) {
+    error_ = "null instance";
+    return;
+  }
+  // An empty submission reports exactly the instance's own error, if any.
+  if (prepared_->failed != PreparedInstance::Stage::None) {
+    error_ = validate(*prepared_, Submission{}, ValidateOptions{}).error_message;
+    return;
+  }
+  genre_run_.max_run = prepared_->ins.max_same_genre;
+  airings_.resize(prepared_->ins.programs.size());
+}
+
+bool StreamValidator::push(const SubmissionItem& it) {
+  if (!error_.empty()) return false;
+  const Instance& ins = prepared_->ins;
+
+  // The reference checks of validate(), per item.
+  SchemaErrors errors(false);
+  const Program* p = check_item_references(ins, it, pushed_, errors);
+  if (const SchemaError* e = errors.first()) {
+    error_ = error_message(*e);
+    return false;
+  }
+  if (!pending_.empty() && it.start < pending_.back().start) {
+    error_ = "Items must arrive in non-decreasing start order.";
+    return false;
+  }
+
+  if (!pending_.empty() && it.start > pending_.back().start) flush_pending();
+  pending_.push_back(TimelineItem{p->id, it.channel_id, p->genre, it.start, it.end, p->ordinal});
+  ++pushed_;
+  return true;
+}
+
+// Items with equal start, in validate()'s timeline order.
+void StreamValidator::flush_pending() {
+  std::sort(pending_.begin(), pending_.end(), [](const TimelineItem& a, const TimelineItem& b){
+    if (a.end != b.end) return a.end < b.end;
+    if (a.channel_id != b.channel_id) return a.channel_id < b.channel_id;
+    return a.program_id < b.program_id;
+  });
+  for (auto& t : pending_) check(std::move(t));
+  pending_.clear();
+}
+
+void StreamValidator::check(TimelineItem t) {
+  const Instance& ins = prepared_->ins;
+  const size_t i = items_.size();
+  const int index = (int)i;
+  items_.push_back(Entry{std::move(t)});
+  Entry& e = items_.back();
+  const TimelineItem& C = e.t;
+
+  bool ok = check_duration(ins, C, index, violations_);
+  if (!genre_run_.push(C)) {
+    violations_.push_back(genre_run_violation(ins, C, index));
+    ok = false;
+  }
+  ok &= check_priority_blocks(ins, C, index, violations_);
+  ok &= check_window(ins, C, index, violations_);
+  e.valid = ok;
+
+  // Items that ended by C.start can no longer overlap anything.
+  size_t w = 0;
+  for (size_t r = 0; r < active_.size(); ++r) {
+    if (items_[active_[r]].t.end > C.start) active_[w++] = active_[r];
+    else retire(active_[r]);
+  }
+  active_.resize(w);
+
+  for (size_t a : active_) {
+    const TimelineItem& A = items_[a].t;
+    if (!(C.start < A.end && C.end > A.start)) continue;
+    invalidate(a);
+    e.valid = false;
+    overlap_pair_key(pair_key_, key_tmp_, A, C);
+    if (reported_overlaps_.insert(pair_key_).second)
+      violations_.push_back(output_overlap_violation(A, C, index));
+  }
+  active_.push_back(i);
+
+  e.input_overlap = prepared_->overlapped_ids.count(C.program_id) > 0;
+  if (e.valid && !e.input_overlap) add_scored(i);
+}
+
+// INPUT_OVERLAP is only reported for items no other rule invalidated, which
+// is known once the item leaves the active set.
+void StreamValidator::retire(size_t i) {
+  Entry& e = items_[i];
+  if (!e.input_overlap || !e.valid) return;
+  e.valid = false;
+  violations_.push_back(input_overlap_violation(e.t, (int)i));
+}
+
+void StreamValidator::invalidate(size_t i) {
+  if (items_[i].scored) remove_scored(i);
+  items_[i].valid = false;
+}
+
+void StreamValidator::add_scored(size_t i) {
+  const Instance& ins = prepared_->ins;
+  const int D = ins.min_duration;
+  Entry& e = items_[i];
+  const Program& p = *ins.programs[e.t.program_ordinal];
+
+  e.scored = true;
+  e.prev = tail_;
+  if (tail_ >= 0) {
+    items_[tail_].next = (int)i;
+    if (items_[tail_].t.channel_id != e.t.channel_id) switches_++;
+  }
+  tail_ = (int)i;
+
+  bonuses_ += item_bonus(ins, e.t, D);
+  if (e.t.start > p.start) late_++;
+  ProgramAirings& a = airings_[p.ordinal];
+  base_ -= a.base(p, D);
+  early_ -= a.early();
+  a.add(p, e.t, D);
+  base_ += a.base(p, D);
+  early_ += a.early();
+}
+
+void StreamValidator::remove_scored(size_t i) {
+  const Instance& ins = prepared_->ins;
+  const int D = ins.min_duration;
+  Entry& e = items_[i];
+  const Program& p = *ins.programs[e.t.program_ordinal];
+
+  // The neighbour pairs around i become one pair.
+  const int ch = e.t.channel_id;
+  if (e.prev >= 0 && items_[e.prev].t.channel_id != ch) switches_--;
+  if (e.next >= 0 && items_[e.next].t.channel_id != ch) switches_--;
+  if (e.prev >= 0 && e.next >= 0 &&
+      items_[e.prev].t.channel_id != items_[e.next].t.channel_id) switches_++;
+  if (e.prev >= 0) items_[e.prev].next = e.next;
+  if (e.next >= 0) items_[e.next].prev = e.prev;
+  if (tail_ == (int)i) tail_ = e.prev;
+  e.prev = e.next = -1;
+  e.scored = false;
+
+  bonuses_ -= item_bonus(ins, e.t, D);
+  if (e.t.start > p.start) late_--;
+  ProgramAirings& a = airings_[p.ordinal];
+  base_ -= a.base(p, D);
+  early_ -= a.early();
+  a.add(p, e.t, D, -1);
+  base_ += a.base(p, D);
+  early_ += a.early();
+}
+
+Score StreamValidator::score() const {
+  const Instance& ins = prepared_->ins;
+  Score s;
+  s.base = base_;
+  s.bonuses = bonuses_;
+  s.switches.count = switches_;
+  s.switches.S = ins.S;
+  s.switches.total = switches_ * ins.S;
+  s.early_late.early = early_;
+  s.early_late.late = late_;
+  s.early_late.T = ins.T;
+  s.early_late.total = (early_ + late_) * ins.T;
+  s.total = base_ + bonuses_ - s.switches.total - s.early_late.total;
+  return s;
+}
+
+Result StreamValidator::finish() {
+  Result result;
+  if (!error_.empty()) {
+    result.status = "ERROR";
+    result.error_message = error_;
+    return result;
+  }
+  flush_pending();
+  for (size_t a : active_) retire(a);
+  active_.clear();
+
+  // validate() reports rule by rule, each in timeline order.
+  auto rank = [](const std::string& code) {
+    if (code == "MAX_GENRE_RUN") return 1;
+    if (code == "PRIORITY_BLOCK_CHANNEL") return 2;
+    if (code == "OUTSIDE_WINDOW") return 3;
+    if (code == "OUTPUT_OVERLAP") return 4;
+    if (code == "INPUT_OVERLAP") return 5;
+    return 0;  // duration checks
+  };
+  result.violations = violations_;
+  std::stable_sort(result.violations.begin(), result.violations.end(),
+                   [&](const Violation& a, const Violation& b) {
+    int ra = rank(a.code), rb = rank(b.code);
+    return ra != rb ? ra < rb : a.item < b.item;
+  });
+
+  bool any_invalid = false;
+  result.strings = prepared_->ins.strings;
+  result.timeline.reserve(items_.size());
+  result.valid.reserve(items_.size());
+  for (const Entry& e : items_) {
+    result.timeline.push_back(e.t);
+    result.valid.push_back(e.valid ? 1 : 0);
+    any_invalid |= !e.valid;
+  }
+  result.status = any_invalid ? "INVALID" : "VALID";
+  result.score = score();
+  return result;
+}
+
+} // namespace tvv
@@ -0,0 +1,97 @@
+#include "thread_pool.hh"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace tvv {
+
+ThreadPool::ThreadPool(unsigned threads) {
+#ifndef TVV_NO_THREADS
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned i = 1; i < threads; ++i)
+    workers_.emplace_back([this]{ worker_loop(); });
+#else
+  (void)threads;
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : workers_) t.join();
+}
+
+void ThreadPool::worker_loop() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lk(mu_);
+      cv_.wait(lk, [&]{ return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  if (workers_.empty()) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    queue_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+  if (n == 0) return;
+  if (workers_.empty() || n == 1) {
+    for (size_t i = 0; i < n; ++i) fn(i);
+    return;
+  }
+
+  // Helpers that start after every index is claimed exit without touching
+  // fn, so the caller only waits for work that is actually running.
+  struct Shared {
+    const std::function<void(size_t)>* fn;
+    size_t n;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mu;
+    std::condition_variable cv;
+  };
+  auto sh = std::make_shared<Shared>();
+  sh->fn = &fn;
+  sh->n = n;
+
+  auto drain = [](Shared& s) {
+    for (size_t i = s.next.fetch_add(1); i < s.n; i = s.next.fetch_add(1)) {
+      (*s.fn)(i);
+      if (s.done.fetch_add(1) + 1 == s.n) {
+        std::lock_guard<std::mutex> lk(s.mu);
+        s.cv.notify_all();
+      }
+    }
+  };
+
+  const size_t helpers = std::min(n - 1, workers_.size());
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (size_t h = 0; h < helpers; ++h)
+      queue_.emplace_back([sh, drain]{ drain(*sh); });
+  }
+  cv_.notify_all();
+
+  drain(*sh);
+  std::unique_lock<std::mutex> lk(sh->mu);
+  sh->cv.wait(lk, [&]{ return sh->done.load() == n; });
+}
+
+} // namespace tvv
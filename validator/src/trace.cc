@@ -0,0 +1,105 @@
+#include "trace.hh"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+namespace tvv {
+
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  char phase;
+  std::int64_t ns;   // steady_clock
+  std::string arg;
+};
+
+// One thread's events; only that thread appends.
+struct ThreadTrace {
+  int tid = 0;
+  std::vector<TraceEvent> events;
+};
+
+// Every thread that has recorded, in first-use order. Buffers outlive
+// their threads (pool workers may exit before the trace is written), and
+// the registry is never destroyed, so late spans at exit stay safe.
+struct TraceRegistry {
+  std::mutex mu;
+  std::vector<std::unique_ptr<ThreadTrace>> threads;
+  std::int64_t epoch_ns = 0;
+};
+
+TraceRegistry& registry() {
+  static TraceRegistry* r = new TraceRegistry();
+  return *r;
+}
+
+std::int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The lock is taken once per thread, on its first event.
+ThreadTrace& this_thread_trace() {
+  thread_local ThreadTrace* t = [] {
+    TraceRegistry& r = registry();
+    std::lock_guard<std::mutex> lk(r.mu);
+    auto& slot = r.threads.emplace_back(std::make_unique<ThreadTrace>());
+    slot->tid = (int)r.threads.size();
+    slot->events.reserve(1024);
+    return slot.get();
+  }();
+  return *t;
+}
+
+} // namespace
+
+void trace_start() {
+  TraceRegistry& r = registry();
+  {
+    std::lock_guard<std::mutex> lk(r.mu);
+    for (auto& t : r.threads) t->events.clear();
+    r.epoch_ns = now_ns();
+  }
+  trace_flag().store(true, std::memory_order_release);
+}
+
+void trace_stop() {
+  trace_flag().store(false, std::memory_order_release);
+}
+
+void trace_event(const char* name, char phase, std::string_view arg) {
+  this_thread_trace().events.push_back(TraceEvent{name, phase, now_ns(), std::string(arg)});
+}
+
+void trace_write(std::ostream& out) {
+  TraceRegistry& r = registry();
+  std::lock_guard<std::mutex> lk(r.mu);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+         "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"tvv\"}}";
+  char ts[32];
+  for (const auto& t : r.threads) {
+    if (t->events.empty()) continue;
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t->tid
+        << ",\"args\":{\"name\":\"thread " << t->tid << "\"}}";
+    for (const TraceEvent& e : t->events) {
+      // Microseconds with nanosecond decimals, as the format expects.
+      const std::int64_t d = e.ns - r.epoch_ns;
+      std::snprintf(ts, sizeof ts, "%lld.%03lld", (long long)(d / 1000), (long long)(d % 1000));
+      out << ",\n{\"name\":" << nlohmann::json(e.name).dump() << ",\"cat\":\"tvv\",\"ph\":\""
+          << e.phase << "\",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << t->tid;
+      if (!e.arg.empty())
+        out << ",\"args\":{\"detail\":"
+            << nlohmann::json(e.arg).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) << "}";
+      out << "}";
+    }
+  }
+  out << "\n]}\n";
+}
+
+} // namespace tvv
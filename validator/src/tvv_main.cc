@@ -0,0 +1,466 @@
+#include "validator.hh"
+#include "compiled_instance.hh"
+#include "mapped_file.hh"
+#include "result_cache.hh"
+#include "server.hh"
+#include "stream.hh"
+#include "thread_pool.hh"
+#include "trace.hh"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace tvv;
+
+static void usage() {
+  std::cerr <<
+    "usage: tvv validate <instance.json> <submission.json> [--verbose] [--marginals] [--cache-dir DIR]\n"
+    "                    [--timeout MS] [--stream [--max-violations N]] [--disable-rule RULE]...\n"
+    "                    [--rule-stats] [--all-errors]\n"
+    "       tvv batch <instance.json> <submission.json>... [--top K] [--threads N] [--verbose]\n"
+    "                 [--timeout MS] [--disable-rule RULE]... [--rule-stats]\n"
+    "       tvv sweep <instance.json> <submission.json> <params.json>\n"
+    "       tvv stream <instance.json> < items.jsonl\n"
+    "       tvv serve <socket-path> [--threads N] [--cache N] [--result-cache MB]\n"
+    "                 [--max-connections N] [--max-payload MB] [--max-pending N]\n"
+    "       tvv compile-instance <instance.json> <instance.tvi>\n"
+    "Wherever an instance is read, a compiled instance (.tvi) may be given instead.\n"
+    "Every subcommand but serve takes --trace FILE: write Chrome trace JSON of the run\n"
+    "(open it in ui.perfetto.dev).\n";
+}
+
+static bool read_file(const char* path, std::string& out) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  std::ostringstream ss;
+  ss << f.rdbuf();
+  out = ss.str();
+  return true;
+}
+
+// Whole-file write through a temporary, so concurrent runs sharing a cache
+// directory never read a partial entry.
+static bool write_file_atomic(const std::string& path, const std::string& data) {
+  const std::string tmp = path + ".tmp" + std::to_string(::getpid());
+  {
+    std::ofstream f(tmp, std::ios::binary);
+    if (!f.write(data.data(), (std::streamsize)data.size())) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Key of the keyed_hash() checks in a --cache-dir, made on first use. link()
+// fails if another run created it meanwhile, and then its key is used.
+static bool cache_dir_key(const std::string& dir, HashKey& key) {
+  const std::string path = dir + "/key";
+  std::string bytes;
+  if (!read_file(path.c_str(), bytes) || bytes.size() != sizeof key) {
+    std::random_device rd;
+    std::string fresh(sizeof key, '\0');
+    for (char& c : fresh) c = (char)rd();
+    const std::string tmp = path + ".tmp" + std::to_string(::getpid());
+    {
+      std::ofstream f(tmp, std::ios::binary);
+      f.write(fresh.data(), (std::streamsize)fresh.size());
+    }
+    if (::link(tmp.c_str(), path.c_str()) != 0 && errno != EEXIST) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+    std::remove(tmp.c_str());
+    if (!read_file(path.c_str(), bytes) || bytes.size() != sizeof key) return false;
+  }
+  std::memcpy(&key, bytes.data(), sizeof key);
+  return true;
+}
+
+// Adds a --disable-rule argument to `disabled`; false for an unknown rule.
+static bool disable_rule(const char* name, std::vector<std::string>& disabled) {
+  const auto& names = rule_names();
+  if (std::find(names.begin(), names.end(), name) == names.end()) {
+    std::cerr << "tvv: unknown rule " << name << "; rules are";
+    for (const auto& n : names) std::cerr << " " << n;
+    std::cerr << "\n";
+    return false;
+  }
+  disabled.push_back(name);
+  return true;
+}
+
+// Deadline `ms` from now; 0 means none.
+static std::optional<std::chrono::steady_clock::time_point> deadline_in(long ms) {
+  if (ms <= 0) return std::nullopt;
+  return std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+}
+
+static int cmd_validate(int argc, char** argv) {
+  if (argc < 2) { usage(); return 2; }
+  ValidateOptions opts;
+  std::string cache_dir;
+  long timeout_ms = 0;
+  bool stream = false;
+  long max_violations = 0;
+  for (int i = 2; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "--verbose") || !std::strcmp(argv[i], "-v")) opts.verbose = true;
+    else if (!std::strcmp(argv[i], "--marginals")) opts.marginals = true;
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--cache-dir")) cache_dir = argv[++i];
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--timeout")) timeout_ms = std::atol(argv[++i]);
+    else if (!std::strcmp(argv[i], "--stream")) stream = true;
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--max-violations")) max_violations = std::atol(argv[++i]);
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--disable-rule")) {
+      if (!disable_rule(argv[++i], opts.disabled_rules)) return 2;
+    }
+    else if (!std::strcmp(argv[i], "--rule-stats")) opts.rule_stats = true;
+    else if (!std::strcmp(argv[i], "--all-errors")) opts.all_errors = true;
+    else { usage(); return 2; }
+  }
+  if (max_violations > 0 && !stream) { usage(); return 2; }
+
+  MappedFile instance, submission;
+  for (int i = 0; i < 2; ++i) {
+    if (!(i == 0 ? instance : submission).open(argv[i], MappedFile::Access::Sequential)) {
+      std::cerr << "tvv: cannot read " << argv[i] << "\n";
+      return 1;
+    }
+  }
+  std::shared_ptr<const PreparedInstance> compiled;
+  if (is_compiled_instance(instance.data())) {
+    std::string error;
+    compiled = load_compiled_instance(instance.data(), error);
+    if (!compiled) { std::cerr << "tvv: " << argv[0] << ": " << error << "\n"; return 1; }
+  }
+
+  // Results on disk are keyed like the in-memory memo: both input hashes,
+  // the validator version and result revision, and the output flags. Rule selection and
+  // statistics are not part of the key, so they bypass it.
+  // --stream prints each violation as a JSON line when found, then the
+  // result (without them); it stops after --max-violations.
+  long seen = 0;
+  if (opts.rule_stats || !opts.disabled_rules.empty()) cache_dir.clear();
+  if (stream) {
+    cache_dir.clear();
+    opts.on_violation = [&](const Violation& v) {
+      std::cout << json{ {"code", v.code}, {"message", v.msg}, {"t", v.t}, {"item", v.item} }.dump()
+                << std::endl;
+      return max_violations <= 0 || ++seen < max_violations;
+    };
+  }
+
+  // Each entry starts with a line holding ResultKey::check, keyed by the
+  // directory's key file; a name collision with another input is a miss.
+  // Entries are keyed by the file as given, so a .tvi and its JSON do not
+  // share them.
+  std::string out, entry, check;
+  HashKey dir_key;
+  if (!cache_dir.empty() && cache_dir_key(cache_dir, dir_key)) {
+    const ResultKey key = ResultKey::of(instance.data(), submission.data(), opts.verbose,
+                                        opts.marginals, opts.all_errors, dir_key);
+    char buf[18];
+    std::snprintf(buf, sizeof buf, "%016llx\n", (unsigned long long)key.check);
+    check = buf;
+    entry = cache_dir + "/" + key.hex() + ".json";
+    if (read_file(entry.c_str(), out) && out.compare(0, check.size(), check) == 0) {
+      std::cout << std::string_view(out).substr(check.size()) << "\n";
+      return 0;
+    }
+  }
+  opts.deadline = deadline_in(timeout_ms);
+  Result r = compiled ? validate(*compiled, submission.data(), opts)
+                      : validate(instance.data(), submission.data(), opts);
+  out = to_json(r);
+  if (!entry.empty() && r.status != "TIMEOUT") write_file_atomic(entry, check + to_cache_json(r, out));
+  std::cout << out << "\n";
+  return 0;
+}
+
+// One JSON line per submission, in argument order. With --top K, each
+// validation is pruned against the K-th best VALID total seen so far; with
+// --rule-stats, the per-rule counters summed over all submissions follow on
+// stderr.
+static int cmd_batch(int argc, char** argv) {
+  std::vector<const char*> files;
+  size_t top_k = 0;
+  unsigned threads = 0;
+  bool verbose = false;
+  long timeout_ms = 0;   // per submission
+  std::vector<std::string> disabled_rules;
+  bool rule_stats = false;
+  for (int i = 0; i < argc; ++i) {
+    if (i + 1 < argc && !std::strcmp(argv[i], "--top")) top_k = (size_t)std::atol(argv[++i]);
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--threads")) threads = (unsigned)std::atoi(argv[++i]);
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--timeout")) timeout_ms = std::atol(argv[++i]);
+    else if (!std::strcmp(argv[i], "--verbose") || !std::strcmp(argv[i], "-v")) verbose = true;
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--disable-rule")) {
+      if (!disable_rule(argv[++i], disabled_rules)) return 2;
+    }
+    else if (!std::strcmp(argv[i], "--rule-stats")) rule_stats = true;
+    else if (argv[i][0] == '-') { usage(); return 2; }
+    else files.push_back(argv[i]);
+  }
+  if (files.size() < 2) { usage(); return 2; }
+
+  // Up first, so the per-channel instance checks run on it as well.
+  ThreadPool pool(threads);
+  std::string error;
+  auto prepared = prepare_instance_file(files[0], error, &pool);
+  if (!prepared) { std::cerr << "tvv: " << error << "\n"; return 1; }
+
+  std::mutex mu;
+  std::priority_queue<int, std::vector<int>, std::greater<int>> best;  // top K totals, min on top
+  size_t pruned = 0, timed_out = 0;
+  std::vector<RuleStats> totals;
+  std::vector<std::string> lines(files.size() - 1);
+
+  pool.parallel_for(lines.size(), [&](size_t i) {
+    const char* path = files[i + 1];
+    TraceSpan span("submission", path);
+    MappedFile submission;
+    if (!submission.open(path, MappedFile::Access::Sequential)) {
+      Result r;
+      r.status = "ERROR";
+      r.error_message = std::string("cannot read ") + path;
+      lines[i] = "{\"file\":" + json(path).dump() + ",\"result\":" + to_json(r) + "}";
+      return;
+    }
+
+    thread_local ScratchArena arena;
+    ValidateOptions opts;
+    opts.verbose = verbose;
+    opts.arena = &arena;
+    // Scoring shards a large timeline across the idle workers; below
+    // kParallelEvalMinShardItems per shard it stays on this thread.
+    opts.pool = &pool;
+    opts.deadline = deadline_in(timeout_ms);
+    opts.disabled_rules = disabled_rules;
+    opts.rule_stats = rule_stats;
+    if (top_k) {
+      std::lock_guard<std::mutex> lk(mu);
+      if (best.size() == top_k) opts.prune_below = best.top();
+    }
+    std::string body;
+    {
+      Result r = validate(*prepared, submission.data(), opts);
+      body = to_json(r);
+      std::lock_guard<std::mutex> lk(mu);
+      if (r.status == "PRUNED") ++pruned;
+      if (r.status == "TIMEOUT") ++timed_out;
+      for (const RuleStats& rs : r.rule_stats) {
+        auto t = std::find_if(totals.begin(), totals.end(),
+                              [&](const RuleStats& x){ return x.name == rs.name; });
+        if (t == totals.end()) totals.push_back(rs);
+        else *t += rs;
+      }
+      if (top_k && r.status == "VALID") {
+        best.push(r.score.total);
+        if (best.size() > top_k) best.pop();
+      }
+    }
+    arena.reset();
+    lines[i] = "{\"file\":" + json(path).dump() + ",\"result\":" + body + "}";
+  });
+
+  for (const auto& l : lines) std::cout << l << "\n";
+  if (top_k) std::cerr << "tvv: " << pruned << " of " << lines.size() << " submissions pruned\n";
+  if (timed_out) std::cerr << "tvv: " << timed_out << " of " << lines.size() << " submissions timed out\n";
+  for (const RuleStats& rs : totals)
+    std::cerr << "tvv: rule " << rs.name << (rs.enabled ? "" : " (disabled)") << ": "
+              << rs.invocations << " runs, " << rs.items << " items, " << rs.violations
+              << " violations, " << rs.ns / 1000 << " us\n";
+  return 0;
+}
+
+// Scores one submission under many parameter settings from a single
+// validation. params.json is an array of {"S":..,"T":..,"bonuses":[..]};
+// omitted fields keep the instance's values.
+static int cmd_sweep(int argc, char** argv) {
+  if (argc != 3) { usage(); return 2; }
+  std::string error;
+  auto prepared = prepare_instance_file(argv[0], error);
+  if (!prepared) { std::cerr << "tvv: " << error << "\n"; return 1; }
+  MappedFile submission;
+  if (!submission.open(argv[1], MappedFile::Access::Sequential)) {
+    std::cerr << "tvv: cannot read " << argv[1] << "\n";
+    return 1;
+  }
+  std::string params_text;
+  if (!read_file(argv[2], params_text)) { std::cerr << "tvv: cannot read " << argv[2] << "\n"; return 1; }
+
+  ScoreCoefficients coeffs;
+  ValidateOptions opts;
+  opts.coefficients = &coeffs;
+  Result r = validate(*prepared, submission.data(), opts);
+  if (r.status == "ERROR") { std::cout << to_json(r) << "\n"; return 0; }
+
+  const Instance& ins = prepared->ins;
+  const size_t P = ins.time_prefs.size();
+  ParamBatch batch;
+  try {
+    json params = json::parse(params_text);
+    if (!params.is_array()) throw std::runtime_error("expected an array of settings");
+    const size_t n = params.size();
+    batch.S.resize(n);
+    batch.T.resize(n);
+    batch.bonus.resize(P * n);
+    for (size_t i = 0; i < n; ++i) {
+      const json& p = params[i];
+      batch.S[i] = p.value("S", ins.S);
+      batch.T[i] = p.value("T", ins.T);
+      const json bonuses = p.value("bonuses", json::array());
+      for (size_t j = 0; j < P; ++j)
+        batch.bonus[j * n + i] = j < bonuses.size() ? bonuses[j].get<int>() : ins.time_prefs[j].bonus;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "tvv: bad parameters in " << argv[2] << ": " << e.what() << "\n";
+    return 1;
+  }
+
+  std::vector<int> totals(batch.size());
+  score_batch(coeffs, batch, totals.data());
+  json out;
+  out["status"] = r.status;
+  out["coefficients"] = { {"base", coeffs.base}, {"pref_hits", coeffs.pref_hits},
+                          {"switches", coeffs.switches}, {"early_late", coeffs.early_late} };
+  out["totals"] = totals;
+  std::cout << out.dump() << "\n";
+  return 0;
+}
+
+// Live playout: one item per stdin line ({"program_id","channel_id","start",
+// "end"}, in start order). Each line is answered with the violations found
+// since the previous one and the provisional score; EOF prints the result.
+static int cmd_stream(int argc, char** argv) {
+  if (argc != 1) { usage(); return 2; }
+  std::string error;
+  auto prepared = prepare_instance_file(argv[0], error);
+  if (!prepared) { std::cerr << "tvv: " << error << "\n"; return 1; }
+
+  StreamValidator stream(std::move(prepared));
+  size_t reported = 0;
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (line.empty()) continue;
+    SubmissionItem item;
+    std::string program_id;  // item.program_id views it until push() returns
+    try {
+      json j = json::parse(line);
+      program_id = j.at("program_id").get<std::string>();
+      item.program_id = program_id;
+      item.channel_id = j.at("channel_id").get<int>();
+      item.start = j.at("start").get<int>();
+      item.end = j.at("end").get<int>();
+    } catch (const std::exception& e) {
+      std::cerr << "tvv: bad item: " << e.what() << "\n";
+      return 1;
+    }
+    if (!stream.push(item)) break;
+
+    json out;
+    out["checked"] = stream.checked();
+    out["violations"] = json::array();
+    const auto& vs = stream.violations();
+    for (; reported < vs.size(); ++reported)
+      out["violations"].push_back({ {"code", vs[reported].code}, {"message", vs[reported].msg},
+                                    {"t", vs[reported].t} });
+    out["score"] = stream.score().total;
+    std::cout << out.dump() << std::endl;
+  }
+  std::cout << to_json(stream.finish()) << "\n";
+  return 0;
+}
+
+// Writes the prepared form of an instance (see compile_instance()), so that
+// later runs load it without parsing or checking the JSON.
+static int cmd_compile_instance(int argc, char** argv) {
+  if (argc != 2) { usage(); return 2; }
+  std::string error;
+  auto prepared = prepare_instance_file(argv[0], error);
+  if (!prepared) { std::cerr << "tvv: " << error << "\n"; return 1; }
+  if (prepared->failed != PreparedInstance::Stage::None) {
+    // The error any validation against it would report.
+    std::cerr << "tvv: " << argv[0] << ": "
+              << validate(*prepared, Submission{}, ValidateOptions{}).error_message << "\n";
+    return 1;
+  }
+  if (!write_file_atomic(argv[1], compile_instance(*prepared))) {
+    std::cerr << "tvv: cannot write " << argv[1] << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+static int cmd_serve(int argc, char** argv) {
+  if (argc < 1) { usage(); return 2; }
+  ServerOptions opts;
+  opts.socket_path = argv[0];
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 < argc && !std::strcmp(argv[i], "--threads")) opts.threads = (unsigned)std::atoi(argv[++i]);
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--cache")) opts.cache_capacity = (size_t)std::atol(argv[++i]);
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--result-cache")) opts.result_cache_bytes = (size_t)std::atol(argv[++i]) << 20;
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--max-connections")) opts.max_connections = (size_t)std::atol(argv[++i]);
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--max-payload")) opts.max_payload = (size_t)std::atol(argv[++i]) << 20;
+    else if (i + 1 < argc && !std::strcmp(argv[i], "--max-pending")) opts.max_pending = (size_t)std::atol(argv[++i]);
+    else { usage(); return 2; }
+  }
+  return serve(opts);
+}
+
+static int run(const std::string& cmd, int argc, char** argv) {
+  if (cmd == "validate") return cmd_validate(argc, argv);
+  if (cmd == "batch") return cmd_batch(argc, argv);
+  if (cmd == "sweep") return cmd_sweep(argc, argv);
+  if (cmd == "stream") return cmd_stream(argc, argv);
+  if (cmd == "serve") return cmd_serve(argc, argv);
+  if (cmd == "compile-instance") return cmd_compile_instance(argc, argv);
+  usage();
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) { usage(); return 2; }
+  const std::string cmd = argv[1];
+
+  // --trace FILE is taken out before the subcommand sees its arguments.
+  std::string trace_path;
+  for (int i = 2; i + 1 < argc; ++i) {
+    if (std::strcmp(argv[i], "--trace")) continue;
+    trace_path = argv[i + 1];
+    std::copy(argv + i + 2, argv + argc, argv + i);
+    argc -= 2;
+    break;
+  }
+  if (trace_path.empty()) return run(cmd, argc - 2, argv + 2);
+  if (cmd == "serve") { usage(); return 2; }
+
+  trace_start();
+  const int rc = run(cmd, argc - 2, argv + 2);
+  trace_stop();
+  std::ofstream f(trace_path);
+  trace_write(f);
+  if (!f.flush()) {
+    std::cerr << "tvv: cannot write " << trace_path << "\n";
+    return rc ? rc : 1;
+  }
+  return rc;
+}
@@ -2,22 +2,60 @@
 #include "rules.hh"
 #include "json.hpp"
 #include <chrono>
-#include <iostream>
 #include <algorithm>
 #include <unordered_map>
 #include <functional>
 #include <unordered_set>
+#include <tuple>
+#include "thread_pool.hh"
+#include "binary_io.hh"
+#include "hash.hh"
+#include "result_cache.hh"
+#include "trace.hh"
 
 using nlohmann::json;
 namespace tvv {
 
-static void collectInputOverlapsAsViolations(
-  const nlohmann::json& input,
-  std::vector<Violation>& out,
-  std::function<void(const std::string&)> logv,
-  std::unordered_set<std::string>& overlapped_prog_ids 
+static void collectInputOverlaps(
+  const Instance& ins,
+  std::pmr::vector<PreparedInstance::InputOverlap>& out,
+  std::pmr::unordered_set<std::string_view>& overlapped_prog_ids,
+  std::pmr::memory_resource* scratch,
+  ThreadPool* pool
 );
 
+// Same-channel overlaps among `n` segments, by sort-and-sweep: after sorting
+// by start, only segments still running at C.start can meet C. `seg(i)`
+// yields {start, end, id}; `hit(a, c)` receives each overlapping pair and
+// returns false to stop early.
+template <class SegFn, class HitFn>
+static void sweep_overlaps(size_t n, SegFn seg, HitFn hit, std::pmr::memory_resource* mem) {
+  std::pmr::vector<size_t> order(n, mem);
+  for (size_t i = 0; i < n; ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+    auto A = seg(a), B = seg(b);
+    if (std::get<0>(A) != std::get<0>(B)) return std::get<0>(A) < std::get<0>(B);
+    if (std::get<1>(A) != std::get<1>(B)) return std::get<1>(A) < std::get<1>(B);
+    return *std::get<2>(A) < *std::get<2>(B);
+  });
+
+  std::pmr::vector<size_t> active(mem);
+  for (size_t i : order) {
+    auto C = seg(i);
+    size_t w = 0;
+    for (size_t r = 0; r < active.size(); ++r)
+      if (std::get<1>(seg(active[r])) > std::get<0>(C)) active[w++] = active[r];
+    active.resize(w);
+
+    for (size_t a : active) {
+      auto A = seg(a);
+      if (std::get<0>(C) < std::get<1>(A) && std::get<1>(C) > std::get<0>(A))
+        if (!hit(a, i)) return;
+    }
+    active.push_back(i);
+  }
+}
+
 static std::string to_json_score(const Score& s) {
   json j;
   j["total"] = s.total;
@@ -30,6 +68,7 @@ static std::string to_json_score(const Score& s) {
 }
 
 std::string to_json(const Result& r) {
+  TraceSpan span("to_json");
   json j;
   j["status"] = r.status;
   j["score"] = json::parse(to_json_score(r.score));
@@ -52,333 +91,757 @@ std::string to_json(const Result& r) {
   j["validator_version"] = r.validator_version;
   j["elapsed_ms"] = r.elapsed_ms;
   if (!r.error_message.empty()) j["error_message"] = r.error_message;
+  if (r.status == "PRUNED") j["upper_bound"] = r.upper_bound;
+  if (!r.marginal.empty()) j["marginal"] = r.marginal;
+  if (!r.phase.empty()) j["phase"] = r.phase;
+  if (!r.errors.empty()) {
+    j["errors"] = json::array();
+    for (const auto& e : r.errors) j["errors"].push_back({ {"path", e.path}, {"message", e.message} });
+  }
+  if (!r.rule_stats.empty()) {
+    j["rule_stats"] = json::array();
+    for (const auto& rs : r.rule_stats)
+      j["rule_stats"].push_back({ {"rule", rs.name}, {"enabled", rs.enabled},
+                                  {"invocations", rs.invocations}, {"items", rs.items},
+                                  {"violations", rs.violations}, {"ns", rs.ns} });
+  }
   if (!r.debug.empty()) {
   j["debug"] = r.debug;
   j["verbose"] = r.debug;
 }
 
-  return j.dump();
+  // A parse error quotes the offending bytes, which need not be UTF-8;
+  // they are replaced rather than thrown on.
+  return j.dump(-1, ' ', false, json::error_handler_t::replace);
 }
 
-Result validate(const std::string& instance_json,
-                const std::string& submission_json,
-                bool verbose) {
-  Result result;
-  std::vector<std::string> dbg;
-  auto logv = [&](std::string s){ if (verbose) dbg.push_back(std::move(s)); };
+namespace {
 
- 
-  json jIns, jSub;
-  try {
-    jIns = json::parse(instance_json);
-    jSub = json::parse(submission_json);
-    logv("Parsed JSON (instance & submission) OK.");
-  } catch (const std::exception& e) {
-    result.status = "ERROR";
-    result.error_message = std::string("JSON parse error: ") + e.what();
-    return result;
+class StringTable {
+public:
+  // `s` must outlive the table; the Result's strings do.
+  std::int32_t add(std::string_view s) {
+    auto [it, inserted] = index_.emplace(s, (std::int32_t)strings_.size());
+    if (inserted) strings_.push_back(s);
+    return it->second;
   }
-
-  if (!validateInputStructure(jIns)) {
-    result.status = "ERROR";
-    result.error_message = "Input structure validation failed.";
-    return result;
-  }
-    if (!validateOutputStructure(jSub)) {
-    result.status = "ERROR";
-    result.error_message = "Output structure validation failed.";
-    return result;
+  void write(BinaryWriter& w) const {
+    std::uint32_t off = 0;
+    w.u32(off);
+    for (std::string_view s : strings_) w.u32(off += (std::uint32_t)s.size());
+    for (std::string_view s : strings_) w.bytes(s);
+    w.align4();
   }
+  std::uint32_t size() const { return (std::uint32_t)strings_.size(); }
 
-  logv("Schema validation OK.");
+private:
+  std::unordered_map<std::string_view, std::int32_t> index_;
+  std::vector<std::string_view> strings_;
+};
 
-  if (!validateOpeningAndClosingTime(jIns) ||
-      !validateChannelsCount(jIns) ||
-      !validatePriorityBlocks(jIns) ||
-      !validateTimePreferences(jIns)) {
-        
-    result.status = "ERROR";
-    result.error_message = "Input validation failed.";
-    return result;
+} // namespace
+
+std::string to_binary(const Result& r) {
+  static_assert(sizeof(std::int32_t) == 4, "");
+  StringTable strings;
+  const std::int32_t version_str = strings.add(r.validator_version);
+  const std::uint32_t error_str = r.error_message.empty()
+    ? 0xFFFFFFFFu : (std::uint32_t)strings.add(r.error_message);
+
+  const size_t n = r.timeline.size(), m = r.violations.size();
+  std::vector<std::int32_t> program(n), genre(n), code(m), message(m);
+  for (size_t i = 0; i < n; ++i) {
+    program[i] = strings.add(r.timeline[i].program_id);
+    genre[i] = r.timeline[i].genre.empty() ? -1 : strings.add(r.timeline[i].genre);
+  }
+  for (size_t i = 0; i < m; ++i) {
+    code[i] = strings.add(r.violations[i].code);
+    message[i] = strings.add(r.violations[i].msg);
   }
-  logv("Instance constraints OK.");
 
-if (!validateProgramsExistInInput(jIns, jSub)) {
-  result.status = "ERROR";
-  result.error_message = "Output validation failed.";
-  return result;
+  BinaryWriter w;
+  w.bytes(std::string_view(kBinaryResultMagic, 4));
+  w.u32(kBinaryResultVersion);
+  static const char* const kStatus[] = {"VALID", "INVALID", "ERROR", "PRUNED", "TIMEOUT", "CANCELLED"};
+  std::uint32_t status = 2;
+  for (std::uint32_t k = 0; k < 6; ++k)
+    if (r.status == kStatus[k]) status = k;
+  w.u32(status);
+  const Score& s = r.score;
+  for (int v : {s.total, s.base, s.bonuses, s.switches.count, s.switches.S, s.switches.total,
+                s.early_late.early, s.early_late.late, s.early_late.T, s.early_late.total})
+    w.i32(v);
+  w.u32((std::uint32_t)n);
+  w.u32((std::uint32_t)m);
+  w.u32(strings.size());
+  w.u32((std::uint32_t)version_str);
+  w.u32(error_str);
+
+  for (const auto& t : r.timeline) w.i32(t.start);
+  for (const auto& t : r.timeline) w.i32(t.end);
+  for (const auto& t : r.timeline) w.i32(t.channel_id);
+  for (std::int32_t v : program) w.i32(v);
+  for (const auto& t : r.timeline) w.i32(t.program_ordinal);
+  for (std::int32_t v : genre) w.i32(v);
+  for (size_t i = 0; i < n; ++i) w.u8(i < r.valid.size() ? r.valid[i] : 1);
+  w.align4();
+
+  for (std::int32_t v : code) w.i32(v);
+  for (const auto& v : r.violations) w.i32(v.item);
+  for (const auto& v : r.violations) w.i32(v.t);
+  for (std::int32_t v : message) w.i32(v);
+
+  strings.write(w);
+  return w.take();
 }
-logv("Output reference checks OK.");
-
 
-if (!validateProgramAndChannel(jSub, jIns)) {
-    result.status = "ERROR";
-    result.error_message = "Program and channel validation failed.";
-    return result;
+Result validate(std::string_view instance_json,
+                std::string_view submission_json,
+                bool verbose) {
+  ValidateOptions opts;
+  opts.verbose = verbose;
+  return validate(instance_json, submission_json, opts);
 }
 
-logv("Program->Channel mapping OK.");
+// Instance half of validate(): everything that does not look at the
+// submission. Memory comes from whatever scratch scope is active.
+static void prepare_into(PreparedInstance& pi, std::string_view instance_json, ThreadPool* pool) {
+  using Stage = PreparedInstance::Stage;
+  {
+    TraceSpan span("parse instance");
+    if (!parse_document(instance_json, pi.doc, pi.error)) {
+      pi.failed = Stage::Parse;
+      return;
+    }
+  }
 
-  Instance ins;
-  Submission sub;
-  try {
-    ins = parse_instance(instance_json);
-    sub = parse_submission(submission_json);
-    logv("Parsed to internal structs OK.");
-  } catch (const std::exception& e) {
-    result.status = "ERROR";
-    result.error_message = std::string("Parsing to structs failed: ") + e.what();
-    return result;
+  // All instance errors are kept: a later submission may ask for them.
+  SchemaErrors errors;
+  {
+    TraceSpan span("instance checks");
+    check_instance(pi.doc, errors, pi.catalog);
+  }
+  if (const SchemaError* e = errors.first()) {
+    using Check = SchemaError::Check;
+    pi.failed = e->check == Check::InputStructure   ? Stage::Structure
+              : e->check == Check::InputConstraints ? Stage::Constraints
+              :                                       Stage::Build;
+    if (pi.failed == Stage::Build) pi.error = e->message;
+    pi.schema_errors = errors.take();
+    return;
   }
 
-  std::vector<TimelineItem> tl;
-  tl.reserve(sub.items.size());
-  for (const auto& it : sub.items) {
-    auto f = ins.program_by_id.find(it.program_id);
-    std::string g = (f == ins.program_by_id.end()) ? "" : f->second->genre;
-    tl.push_back(TimelineItem{it.program_id, it.channel_id, g, it.start, it.end});
+  {
+    TraceSpan span("build instance");
+    if (!build_instance(pi.doc, pi.ins, pi.error)) {
+      pi.failed = Stage::Build;
+      pi.schema_errors.push_back(SchemaError{SchemaError::Check::InputBuild, "", pi.error});
+      return;
+    }
   }
-  std::sort(tl.begin(), tl.end(), [](const TimelineItem& a, const TimelineItem& b){
-    if (a.start != b.start) return a.start < b.start;
-    if (a.end   != b.end  ) return a.end   < b.end;
-    if (a.channel_id != b.channel_id) return a.channel_id < b.channel_id;
-    return a.program_id < b.program_id;
+
+  TraceSpan span("input overlaps");
+  collectInputOverlaps(pi.ins, pi.input_overlaps, pi.overlapped_ids,
+                       scratch_or_default(), pool);
+}
+
+std::shared_ptr<const PreparedInstance> prepare_instance(std::string_view instance_json,
+                                                         ThreadPool* pool) {
+  // Built and destroyed on the heap whatever scope the caller is in: cached
+  // instances outlive the call and may be released from inside another
+  // validate().
+  ScratchScope heap(nullptr);
+  auto* pi = new PreparedInstance();
+  std::shared_ptr<const PreparedInstance> out(pi, [](const PreparedInstance* p) {
+    ScratchScope heap(nullptr);
+    delete p;
   });
-  logv("Built timeline with " + std::to_string(tl.size()) + " items.");
+  pi->content_hash = hash_bytes(instance_json);
+  pi->content_check = keyed_hash(process_hash_key(), instance_json);
+  prepare_into(*pi, instance_json, pool);
+  return out;
+}
 
- 
-std::vector<char> valid_mask(tl.size(), 1);
-std::vector<Violation> all_violations;
-auto add_violation = [&](Violation v){
-  all_violations.push_back(std::move(v));
-};
- 
-// MIN_CONTIGUOUS_DURATION
-for (size_t i = 0; i < tl.size(); ++i) {
-  const auto& t = tl[i];
-  int W = t.end - t.start;
+static Result validate_prepared(const PreparedInstance& pi,
+                                std::string_view submission_json,
+                                const ValidateOptions& opts,
+                                ScratchArena* arena,
+                                Interrupt& stop);
+static Result score_submission(const PreparedInstance& pi,
+                               const Submission& sub,
+                               const ValidateOptions& opts,
+                               ScratchArena* arena,
+                               Interrupt& stop,
+                               std::vector<std::string> dbg);
+
+// Partial result of a validation stopped by `stop` during `phase`.
+static Result interrupted(Result r, const Interrupt& stop, std::string phase) {
+  const bool timeout = stop.reason() == Interrupt::Reason::Timeout;
+  r.status = timeout ? "TIMEOUT" : "CANCELLED";
+  r.error_message = std::string(timeout ? "Validation timed out" : "Validation cancelled") +
+                    " during " + phase + ".";
+  r.phase = std::move(phase);
+  return r;
+}
 
+Result validate(std::string_view instance_json,
+                std::string_view submission_json,
+                const ValidateOptions& opts) {
+  TraceSpan span("validate");
+  std::optional<ScratchArena> local_arena;
+  ScratchArena* arena = opts.arena ? opts.arena : &local_arena.emplace();
+  ScratchScope scratch_scope(arena);
+
+  Interrupt stop(opts.deadline, opts.cancel);
+  if (opts.on_phase) opts.on_phase("instance");
+  PreparedInstance pi;
+  ReleaseOnExit release_instance(pi.doc);
+  prepare_into(pi, instance_json, opts.pool);
+  if (stop.check()) return interrupted(Result(), stop, "instance");
+  return validate_prepared(pi, submission_json, opts, arena, stop);
+}
 
-  int L = 0;
-  {
-    auto itP = ins.program_by_id.find(t.program_id);
-    if (itP != ins.program_by_id.end() && itP->second) {
-  
-      L = itP->second->end - itP->second->start;
-    } else {
+Result validate(const PreparedInstance& prepared,
+                std::string_view submission_json,
+                const ValidateOptions& opts) {
+  TraceSpan span("validate");
+  std::optional<ScratchArena> local_arena;
+  ScratchArena* arena = opts.arena ? opts.arena : &local_arena.emplace();
+  ScratchScope scratch_scope(arena);
+  Interrupt stop(opts.deadline, opts.cancel);
+  return validate_prepared(prepared, submission_json, opts, arena, stop);
+}
 
-      logv("[WARN] Program id not found in instance map for " + t.program_id + " while checking MIN_CONTIGUOUS_DURATION.");
- 
-      add_violation(Violation{
-        "PROGRAM_NOT_IN_INSTANCE",
-        "INVALID: Program '" + t.program_id + "' not found in instance when checking duration constraints.",
-        t.start
-      });
-      valid_mask[i] = 0;
-      continue;
-    }
+Result validate(const PreparedInstance& prepared,
+                const Submission& submission,
+                const ValidateOptions& opts) {
+  using Stage = PreparedInstance::Stage;
+  TraceSpan span("validate");
+  Result result;
+  auto fail = [&](std::string msg) {
+    result.status = "ERROR";
+    result.error_message = std::move(msg);
+    return result;
+  };
+  if (opts.all_errors) result.errors = prepared.schema_errors;
+  if (prepared.failed == Stage::Parse) return fail("JSON parse error: " + prepared.error);
+  if (prepared.failed != Stage::None) {
+    SchemaErrors errors(false);
+    for (const SchemaError& e : prepared.schema_errors) errors.add(e.check, e.path, e.message);
+    return fail(error_message(*errors.first()));
   }
 
-  const int D = ins.min_duration;
+  // The reference checks of the JSON path, on resolved programs: each item
+  // names a catalog program, which belongs to the item's channel. Unknown
+  // programs are reported before channel mismatches.
+  SchemaErrors errors(false);
+  for (size_t i = 0; i < submission.items.size(); ++i)
+    check_item_references(prepared.ins, submission.items[i], i, errors);
+  if (const SchemaError* e = errors.first()) return fail(error_message(*e));
+
+  std::optional<ScratchArena> local_arena;
+  ScratchArena* arena = opts.arena ? opts.arena : &local_arena.emplace();
+  ScratchScope scratch_scope(arena);
+  Interrupt stop(opts.deadline, opts.cancel);
+  return score_submission(prepared, submission, opts, arena, stop, {});
+}
 
-  if (L >= D) {
+// PRUNED depends on the threshold and TIMEOUT/CANCELLED on timing, not
+// only on the inputs.
+std::string to_cache_json(const Result& r, std::string json) {
+  if (r.elapsed_ms == 0) return json;
+  Result hit = r;
+  hit.elapsed_ms = 0;
+  return to_json(hit);
+}
 
-    if (W < D) {
-      add_violation(Violation{
-        "MIN_CONTIGUOUS_DURATION_UNDER_D",
-        "INVALID: Program '" + t.program_id + "' scheduled for " + std::to_string(W) +
-        " min, which is less than required minimum of " + std::to_string(D) + " min.",
-        t.start
-      });
-      valid_mask[i] = 0;
-      logv("[VIOL] MIN_CONTIGUOUS_DURATION_UNDER_D at " + std::to_string(t.start) + " for " + t.program_id);
-    }
-  } else {
-    if (W != L) {
-      add_violation(Violation{
-        "SHORT_PROGRAM_MUST_BE_FULL",
-        "INVALID: Program '" + t.program_id + "' is shorter than D (" + std::to_string(L) +
-        " min < " + std::to_string(D) + " min) and must be scheduled in full; got " + std::to_string(W) + " min.",
-        t.start
-      });
-      valid_mask[i] = 0;
-      logv("[VIOL] SHORT_PROGRAM_MUST_BE_FULL at " + std::to_string(t.start) + " for " + t.program_id);
-    }
-  }
+static bool memoizable(const Result& r) {
+  return r.status == "VALID" || r.status == "INVALID" || r.status == "ERROR";
+}
+
+std::string validate_to_json(std::string_view instance_json,
+                             std::string_view submission_json,
+                             const ValidateOptions& opts) {
+  if (!opts.memo || opts.on_violation || opts.on_phase || opts.rule_stats || opts.coefficients ||
+      !opts.disabled_rules.empty())
+    return to_json(validate(instance_json, submission_json, opts));
+  const ResultKey key = ResultKey::of(instance_json, submission_json, opts.verbose, opts.marginals, opts.all_errors);
+  std::string out;
+  if (opts.memo->find(key, out)) return out;
+  Result r = validate(instance_json, submission_json, opts);
+  out = to_json(r);
+  if (memoizable(r)) opts.memo->insert(key, to_cache_json(r, out));
+  return out;
 }
 
+std::string validate_to_json(const PreparedInstance& prepared,
+                             std::string_view submission_json,
+                             const ValidateOptions& opts) {
+  if (!opts.memo || opts.on_violation || opts.on_phase || opts.rule_stats || opts.coefficients ||
+      !opts.disabled_rules.empty())
+    return to_json(validate(prepared, submission_json, opts));
+  const ResultKey key = ResultKey::of(prepared.content_hash, prepared.content_check, submission_json, opts.verbose, opts.marginals, opts.all_errors);
+  std::string out;
+  if (opts.memo->find(key, out)) return out;
+  Result r = validate(prepared, submission_json, opts);
+  out = to_json(r);
+  if (memoizable(r)) opts.memo->insert(key, to_cache_json(r, out));
+  return out;
+}
 
-// MAX_GENRE_RUN
-{
-  int run = 0;
-  std::string last;
-  for (size_t i = 0; i < tl.size(); ++i) {
-    const auto& t = tl[i];
-    if (t.genre.empty()) { last.clear(); run = 0; continue; }
+// The checks below report in the order of the original single pass, so an
+// instance failure is reported only where that pass would have hit it.
+static Result validate_prepared(const PreparedInstance& pi,
+                                std::string_view submission_json,
+                                const ValidateOptions& opts,
+                                ScratchArena* arena,
+                                Interrupt& stop) {
+  using Stage = PreparedInstance::Stage;
+  const bool verbose = opts.verbose;
 
-    if (t.genre == last) {
-      run++;
-    } else {
-      last = t.genre;
-      run = 1;
-    }
+  Result result;
+  std::vector<std::string> dbg;
+  auto logv = [&](std::string s){ if (verbose) dbg.push_back(std::move(s)); };
 
-    if (run > ins.max_same_genre) {
-      add_violation(Violation{
-        "MAX_GENRE_RUN",
-        "INVALID: More than " + std::to_string(ins.max_same_genre) +
-        " consecutive programs of genre '" + t.genre + "'. Offending program: '" + t.program_id + "'.",
-        t.start
-      });
-      valid_mask[i] = 0;
-      logv("[VIOL] MAX_GENRE_RUN at " + std::to_string(t.start) + " for " + t.program_id + " (genre " + t.genre + ")");
+  if (pi.failed == Stage::Parse) {
+    result.status = "ERROR";
+    result.error_message = "JSON parse error: " + pi.error;
+    return result;
+  }
+  if (opts.on_phase) opts.on_phase("parse");
+  Document jSub;
+  ReleaseOnExit release_submission(jSub);
+  std::string parse_error;
+  {
+    TraceSpan span("parse submission");
+    if (!parse_document(submission_json, jSub, parse_error)) {
+      result.status = "ERROR";
+      result.error_message = "JSON parse error: " + parse_error;
+      return result;
     }
   }
+  if (verbose) logv("Parsed JSON (instance & submission) OK.");
+  if (stop.check()) return interrupted(std::move(result), stop, "parse");
+  if (opts.on_phase) opts.on_phase("references");
+
+  // One walk of the submission for its structure, types and references,
+  // merged with the instance's errors; the earliest failing check is the
+  // one reported. Without a complete catalog the references are skipped.
+  SchemaErrors errors(opts.all_errors);
+  for (const SchemaError& e : pi.schema_errors) errors.add(e.check, e.path, e.message);
+  Submission sub;
+  {
+    TraceSpan span("submission checks");
+    check_submission(jSub, pi.failed == Stage::Structure ? nullptr : &pi.catalog, errors, sub);
+  }
+  if (const SchemaError* e = errors.first()) {
+    result.status = "ERROR";
+    result.error_message = error_message(*e);
+    if (opts.all_errors) result.errors = errors.take();
+    return result;
+  }
+  if (verbose) {
+    logv("Schema validation OK.");
+    logv("Instance constraints OK.");
+    logv("Output reference checks OK.");
+    logv("Program->Channel mapping OK.");
+  }
+  if (stop.check()) return interrupted(std::move(result), stop, "references");
+  if (verbose) logv("Parsed to internal structs OK.");
+
+  return score_submission(pi, sub, opts, arena, stop, std::move(dbg));
 }
 
-  
-// PRIORITY_BLOCK_CHANNEL
-auto in_block = [](int s1,int e1,int s2,int e2){
-  return !(e1 <= s2 || e2 <= s1);
+namespace {
+
+// State shared by the rule passes of one score_submission() call.
+struct RuleContext {
+  const PreparedInstance& pi;
+  const Instance& ins;
+  const Timeline& tl;
+  std::pmr::vector<char>& valid;
+  std::vector<Violation>& violations;
+  Interrupt& stop;
+  const ValidateOptions& opts;
+  std::vector<std::string>& dbg;
+  std::pmr::memory_resource* arena;
+  std::vector<RuleStats>* stats = nullptr;  // with opts.rule_stats
+  size_t delivered = 0;                     // violations handed to on_violation
+
+  bool verbose() const { return opts.verbose; }
+  void log(std::string s) { if (opts.verbose) dbg.push_back(std::move(s)); }
+  size_t emitted() const { return delivered + violations.size(); }
+  bool disabled(const char* rule) const {
+    return std::find(opts.disabled_rules.begin(), opts.disabled_rules.end(), rule) !=
+           opts.disabled_rules.end();
+  }
+
+  // With opts.on_violation, new violations are handed over and dropped
+  // instead of kept; after a false return nothing more is delivered.
+  void deliver() {
+    if (!opts.on_violation) return;
+    for (const Violation& v : violations) {
+      if (stop.reason() != Interrupt::Reason::None) break;
+      if (!opts.on_violation(v)) stop.cancel();
+    }
+    delivered += violations.size();
+    violations.clear();
+  }
+  void add(Violation v) {
+    violations.push_back(std::move(v));
+    deliver();
+  }
 };
-for (size_t i = 0; i < tl.size(); ++i) {
-  const auto& t = tl[i];
-  for (const auto& b : ins.priority_blocks) {
-    if (!b.allowed_channels.empty() && in_block(t.start, t.end, b.start, b.end)) {
-      bool allowed = std::find(b.allowed_channels.begin(), b.allowed_channels.end(),
-                               t.channel_id) != b.allowed_channels.end();
-      if (!allowed) {
-        add_violation(Violation{
-          "PRIORITY_BLOCK_CHANNEL",
-          "INVALID: Program '" + t.program_id + "' is scheduled in Channel " + std::to_string(t.channel_id) +
-          " during the priority block [" + std::to_string(b.start) + "-" + std::to_string(b.end) + "], but this channel is not allowed in this block.",
-          t.start
-        });
-        valid_mask[i] = 0;
-        logv("[VIOL] PRIORITY_BLOCK_CHANNEL at " + std::to_string(t.start) + " for " + t.program_id);
+
+// Each rule is one pass over the timeline in rule order. run() returns the
+// number of items checked, fewer than tl.size() when `stop` tripped; the
+// rule's kName is then the interrupted phase.
+
+struct DurationRule {
+  static constexpr const char* kName = "MIN_CONTIGUOUS_DURATION";
+  static size_t run(RuleContext& cx) {
+    for (size_t i = 0; i < cx.tl.size(); ++i) {
+      if (cx.stop.poll()) return i;
+      const auto& t = cx.tl[i];
+      if (check_duration(cx.ins, t, (int)i, cx.violations)) continue;
+      cx.valid[i] = 0;
+      if (cx.verbose()) {
+        const std::string& code = cx.violations.back().code;
+        if (code == "PROGRAM_NOT_IN_INSTANCE")
+          cx.log("[WARN] Program id not found in instance map for " + std::string(t.program_id) + " while checking MIN_CONTIGUOUS_DURATION.");
+        else
+          cx.log("[VIOL] " + code + " at " + std::to_string(t.start) + " for " + std::string(t.program_id));
       }
+      cx.deliver();
     }
+    return cx.tl.size();
   }
-}
+};
 
+struct GenreRunRule {
+  static constexpr const char* kName = "MAX_GENRE_RUN";
+  static size_t run(RuleContext& cx) {
+    GenreRun genre_run;
+    genre_run.max_run = cx.ins.max_same_genre;
+    for (size_t i = 0; i < cx.tl.size(); ++i) {
+      if (cx.stop.poll()) return i;
+      const auto& t = cx.tl[i];
+      if (genre_run.push(t)) continue;
+      cx.add(genre_run_violation(cx.ins, t, (int)i));
+      cx.valid[i] = 0;
+      if (cx.verbose()) cx.log("[VIOL] MAX_GENRE_RUN at " + std::to_string(t.start) + " for " + std::string(t.program_id) + " (genre " + std::string(t.genre) + ")");
+    }
+    return cx.tl.size();
+  }
+};
 
-//  OUTSIDE_WINDOW → INVALID
-{
-  const int O = ins.opening_time;
-  const int E = ins.closing_time;
-  for (size_t i = 0; i < tl.size(); ++i) {
-    const auto& t = tl[i];
-
-    if (t.start < O || t.end > E) {
-      add_violation(Violation{
-        "OUTSIDE_WINDOW",
-        "INVALID: Program '" + t.program_id + "' is scheduled outside the global window [" +
-          std::to_string(O) + "," + std::to_string(E) + ").",
-        t.start
-      });
-      valid_mask[i] = 0;
-      logv("[VIOL] OUTSIDE_WINDOW at " + std::to_string(t.start) + " for " + t.program_id);
+struct PriorityBlockRule {
+  static constexpr const char* kName = "PRIORITY_BLOCK_CHANNEL";
+  static size_t run(RuleContext& cx) {
+    for (size_t i = 0; i < cx.tl.size(); ++i) {
+      if (cx.stop.poll()) return i;
+      const auto& t = cx.tl[i];
+      const size_t before = cx.violations.size();
+      if (check_priority_blocks(cx.ins, t, (int)i, cx.violations)) continue;
+      cx.valid[i] = 0;
+      if (cx.verbose())
+        for (size_t k = before; k < cx.violations.size(); ++k)
+          cx.log("[VIOL] PRIORITY_BLOCK_CHANNEL at " + std::to_string(t.start) + " for " + std::string(t.program_id));
+      cx.deliver();
     }
+    return cx.tl.size();
   }
-}
+};
 
+struct WindowRule {
+  static constexpr const char* kName = "OUTSIDE_WINDOW";
+  static size_t run(RuleContext& cx) {
+    for (size_t i = 0; i < cx.tl.size(); ++i) {
+      if (cx.stop.poll()) return i;
+      const auto& t = cx.tl[i];
+      if (check_window(cx.ins, t, (int)i, cx.violations)) continue;
+      cx.valid[i] = 0;
+      if (cx.verbose()) cx.log("[VIOL] OUTSIDE_WINDOW at " + std::to_string(t.start) + " for " + std::string(t.program_id));
+      cx.deliver();
+    }
+    return cx.tl.size();
+  }
+};
 
-// OUTPUT_OVERLAP
-{
-  std::vector<size_t> active;
-  active.reserve(tl.size()); 
+struct OutputOverlapRule {
+  static constexpr const char* kName = "OUTPUT_OVERLAP";
+  static size_t run(RuleContext& cx) {
+    const Timeline& tl = cx.tl;
+    std::pmr::vector<size_t> active(cx.arena);
+    active.reserve(tl.size());
+    std::pmr::unordered_set<std::pmr::string> reported_overlaps(cx.arena);
+    std::pmr::string pair_key(cx.arena), tmp(cx.arena);
+
+    for (size_t i = 0; i < tl.size(); ++i) {
+      const auto& C = tl[i];
+      size_t w = 0;
+      for (size_t r = 0; r < active.size(); ++r)
+        if (tl[active[r]].end > C.start) active[w++] = active[r];
+      active.resize(w);
 
+      // Polled per pair: with many concurrent items the active set is large.
+      for (size_t r = 0; r < active.size(); ++r) {
+        if (cx.stop.poll()) return i;
+        const size_t iPrev = active[r];
+        const auto& A = tl[iPrev];
+        if (!(C.start < A.end && C.end > A.start)) continue;
+
+        cx.valid[iPrev] = 0;
+        cx.valid[i]     = 0;
+        overlap_pair_key(pair_key, tmp, A, C);
+        if (reported_overlaps.insert(pair_key).second) {
+          cx.add(output_overlap_violation(A, C, (int)i));
+          if (cx.verbose()) cx.log("[VIOL] OUTPUT_OVERLAP " + std::string(A.program_id) + " (ch " + std::to_string(A.channel_id) +
+               ") <-> " + std::string(C.program_id) + " (ch " + std::to_string(C.channel_id) + ")");
+        }
+      }
+      active.push_back(i);
+    }
+    return cx.tl.size();
+  }
+};
 
-  std::unordered_set<std::string> reported_overlaps;
-  auto mk_key = [&](const TimelineItem& X){
-    return X.program_id + "|ch" + std::to_string(X.channel_id) +
-           "|" + std::to_string(X.start) + "-" + std::to_string(X.end);
-  };
+struct InputOverlapRule {
+  static constexpr const char* kName = "INPUT_OVERLAP";
+  static size_t run(RuleContext& cx) {
+    if (cx.verbose())
+      for (const auto& o : cx.pi.input_overlaps)
+        cx.log("[WARN] INPUT_OVERLAP in input ch=" + std::to_string(o.channel_id) + " " + std::string(o.a->id) + " <-> " + std::string(o.b->id));
+    const auto& overlapped_in_input = cx.pi.overlapped_ids;
+    for (size_t i = 0; i < cx.tl.size(); ++i) {
+      if (cx.stop.poll()) return i;
+      const auto& t = cx.tl[i];
+      if (!cx.valid[i] || overlapped_in_input.find(t.program_id) == overlapped_in_input.end()) continue;
+      cx.valid[i] = 0;
+      cx.add(input_overlap_violation(t, (int)i));
+      if (cx.verbose()) cx.log("[VIOL] INPUT_OVERLAP → exclude from score (ref in submission): " + std::string(t.program_id));
+    }
+    return cx.tl.size();
+  }
+};
 
-  for (size_t i = 0; i < tl.size(); ++i) {
-    const auto& C = tl[i];
+// A rule the instance cannot violate: its phase is still reported, its
+// pass is compiled out.
+template <bool On, class Rule>
+struct Enabled : Rule {};
+template <class Rule>
+struct Enabled<false, Rule> {
+  static constexpr const char* kName = Rule::kName;
+};
 
-  
-    size_t w = 0;
-    for (size_t r = 0; r < active.size(); ++r) {
-      const auto& A = tl[active[r]];
-      if (A.end > C.start) active[w++] = active[r];
+template <class Rule> constexpr bool kCompiledIn = true;
+template <class Rule> constexpr bool kCompiledIn<Enabled<false, Rule>> = false;
+
+// One pass, unless opts.disabled_rules lists it, with its counters in
+// cx.stats. Returns false when the pass was interrupted.
+template <class Rule>
+bool run_rule(RuleContext& cx, const char*& interrupted) {
+  RuleStats* st = nullptr;
+  if (cx.stats) {
+    st = &cx.stats->emplace_back();
+    st->name = Rule::kName;
+  }
+  if (cx.disabled(Rule::kName)) {
+    if (st) st->enabled = false;
+    return true;
+  }
+  if (cx.opts.on_phase) cx.opts.on_phase(Rule::kName);
+  if constexpr (kCompiledIn<Rule>) {
+    TraceSpan span(Rule::kName);
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point t0 = st ? Clock::now() : Clock::time_point();
+    const size_t before = cx.emitted();
+    const size_t items = Rule::run(cx);
+    if (st) {
+      st->invocations = 1;
+      st->items = items;
+      st->violations = cx.emitted() - before;
+      st->ns = (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
     }
-    active.resize(w);
+    // A violation callback may trip the interrupt on the last item.
+    if (items < cx.tl.size() || cx.stop.reason() != Interrupt::Reason::None) {
+      interrupted = Rule::kName;
+      return false;
+    }
+  }
+  return true;
+}
 
- 
-    for (size_t r = 0; r < active.size(); ++r) {
-      size_t iPrev = active[r];
-      const auto& A = tl[iPrev];
+// Rule-set policy: runs `Rules` in order and returns the kName of the one
+// that was interrupted, or nullptr.
+template <class... Rules>
+struct RuleSet {
+  static const char* run(RuleContext& cx) {
+    const char* interrupted = nullptr;
+    (run_rule<Rules>(cx, interrupted) && ...);
+    return interrupted;
+  }
+  static std::vector<std::string> names() { return {Rules::kName...}; }
+};
+
+template <bool Genre, bool Blocks, bool Input>
+using RulesFor = RuleSet<DurationRule,
+                         Enabled<Genre, GenreRunRule>,
+                         Enabled<Blocks, PriorityBlockRule>,
+                         WindowRule,
+                         OutputOverlapRule,
+                         Enabled<Input, InputOverlapRule>>;
+
+// Picks, once per submission, the rule set with the passes this instance
+// can trip: a genre run longer than the timeline cannot exceed the limit,
+// blocks without allowed channels restrict nothing, and INPUT_OVERLAP needs
+// overlapping programs in the catalog.
+const char* run_rules(RuleContext& cx) {
+  const Instance& ins = cx.ins;
+  const bool genre = (long long)cx.tl.size() > ins.max_same_genre;
+  const bool blocks = std::any_of(ins.priority_blocks.begin(), ins.priority_blocks.end(),
+                                  [](const PriorityBlock& b){ return !b.allowed_channels.empty(); });
+  const bool input = !cx.pi.overlapped_ids.empty();
+
+  using Run = const char* (*)(RuleContext&);
+  static constexpr Run kSpecialized[8] = {
+    &RulesFor<false, false, false>::run, &RulesFor<false, false, true>::run,
+    &RulesFor<false, true,  false>::run, &RulesFor<false, true,  true>::run,
+    &RulesFor<true,  false, false>::run, &RulesFor<true,  false, true>::run,
+    &RulesFor<true,  true,  false>::run, &RulesFor<true,  true,  true>::run,
+  };
+  return kSpecialized[genre << 2 | blocks << 1 | input](cx);
+}
 
-      if ((C.start < A.end) && (C.end > A.start)) {
+} // namespace
 
-        valid_mask[iPrev] = 0;
-        valid_mask[i]     = 0;
+const std::vector<std::string>& rule_names() {
+  static const std::vector<std::string> names = RulesFor<true, true, true>::names();
+  return names;
+}
 
-        std::string k1 = mk_key(A);
-        std::string k2 = mk_key(C);
-        std::string pair_key = (k1 < k2) ? (k1 + "||" + k2) : (k2 + "||" + k1);
+// Rule checks and scoring for a submission that passed the reference checks.
+static Result score_submission(const PreparedInstance& pi,
+                               const Submission& sub,
+                               const ValidateOptions& opts,
+                               ScratchArena* arena,
+                               Interrupt& stop,
+                               std::vector<std::string> dbg) {
+  const bool verbose = opts.verbose;
+  const Instance& ins = pi.ins;
+  Result result;
+  auto logv = [&](std::string s){ if (verbose) dbg.push_back(std::move(s)); };
 
-        if (reported_overlaps.insert(pair_key).second) {
-          add_violation(Violation{
-            "OUTPUT_OVERLAP",
-            "INVALID: Overlap between '" + A.program_id + "' [ch " + std::to_string(A.channel_id) +
-              ", " + std::to_string(A.start) + "-" + std::to_string(A.end) + "] and '" +
-              C.program_id + "' [ch " + std::to_string(C.channel_id) + ", " +
-              std::to_string(C.start) + "-" + std::to_string(C.end) + "].",
-            std::min(A.start, C.start)
-          });
-          logv("[VIOL] OUTPUT_OVERLAP " + A.program_id + " (ch " + std::to_string(A.channel_id) +
-               ") <-> " + C.program_id + " (ch " + std::to_string(C.channel_id) + ")");
-        }
+  if (opts.prune_below) {
+    TraceSpan span("upper bound");
+    const int bound = score_upper_bound(ins, sub, arena);
+    if (bound < *opts.prune_below) {
+      result.status = "PRUNED";
+      result.upper_bound = bound;
+      if (verbose) {
+        logv("[PRUNE] upper bound " + std::to_string(bound) + " < threshold " +
+             std::to_string(*opts.prune_below) + "; rule checks and scoring skipped.");
+        result.debug = std::move(dbg);
       }
+      return result;
     }
-
-    active.push_back(i);
   }
-}
 
-std::unordered_set<std::string> overlapped_in_input;
-collectInputOverlapsAsViolations(jIns, all_violations, logv, overlapped_in_input);
-
-for (size_t i = 0; i < tl.size(); ++i) {
-  if (overlapped_in_input.find(tl[i].program_id) != overlapped_in_input.end()) {
-    if (valid_mask[i]) {
-      valid_mask[i] = 0;
-      add_violation(Violation{
-        "INPUT_OVERLAP",
-        "INVALID: Referenced program '" + tl[i].program_id +
-        "' overlaps with another program in the input; excluded from scoring.",
-        tl[i].start
-      });
-      logv("[VIOL] INPUT_OVERLAP → exclude from score (ref in submission): " + tl[i].program_id);
+  if (opts.on_phase) opts.on_phase("timeline");
+  // Items that passed the reference checks resolve, so the timeline views
+  // the instance's strings rather than the submission's. Only the unchecked
+  // "schedule" array can name an unknown program; as before, it is kept with
+  // no genre, and its id is copied to a pool of the result's own.
+  result.strings = ins.strings;
+  std::shared_ptr<StringPool> unknown_ids;
+  Timeline tl(arena);
+  TraceSpan timeline_span("timeline");
+  tl.reserve(sub.items.size());
+  for (const auto& it : sub.items) {
+    const Program* p = nullptr;
+    if (it.program_ordinal >= 0 && (size_t)it.program_ordinal < ins.programs.size()) {
+      p = ins.programs[it.program_ordinal];
+    } else if (auto f = ins.program_by_id.find(it.program_id); f != ins.program_by_id.end()) {
+      p = f->second;
+    } else {
+      if (!unknown_ids) unknown_ids = std::make_shared<StringPool>();
+      tl.push_back(TimelineItem{unknown_ids->intern(it.program_id), it.channel_id, {}, it.start, it.end, -1});
+      continue;
     }
+    tl.push_back(TimelineItem{p->id, it.channel_id, p->genre, it.start, it.end, p->ordinal});
   }
-}
+  if (unknown_ids) {
+    struct Pools { std::shared_ptr<const StringPool> instance, unknown; };
+    auto both = std::make_shared<Pools>(Pools{ins.strings, unknown_ids});
+    result.strings = std::shared_ptr<const StringPool>(both, unknown_ids.get());
+  }
+  std::sort(tl.begin(), tl.end(), [](const TimelineItem& a, const TimelineItem& b){
+    if (a.start != b.start) return a.start < b.start;
+    if (a.end   != b.end  ) return a.end   < b.end;
+    if (a.channel_id != b.channel_id) return a.channel_id < b.channel_id;
+    return a.program_id < b.program_id;
+  });
+  if (verbose) logv("Built timeline with " + std::to_string(tl.size()) + " items.");
+  timeline_span.end();
+
+ 
+std::pmr::vector<char> valid_mask(tl.size(), 1, arena);
+std::vector<Violation> all_violations;
+RuleContext cx{pi, ins, tl, valid_mask, all_violations, stop, opts, dbg, arena,
+               opts.rule_stats ? &result.rule_stats : nullptr};
+// What was found before `phase` was interrupted.
+auto stopped = [&](const char* phase) {
+  result.violations = std::move(all_violations);
+  result.timeline.assign(tl.begin(), tl.end());
+  if (verbose) result.debug = std::move(dbg);
+  return interrupted(std::move(result), stop, phase);
+};
+if (stop.check()) return stopped("timeline");
+if (const char* phase = run_rules(cx)) return stopped(phase);
 
 
 bool any_invalid = std::any_of(valid_mask.begin(), valid_mask.end(),
                                [](char v){ return v == 0; });
 
-std::vector<TimelineItem> filtered;
+Timeline filtered(arena);
 if (any_invalid) {
   filtered.reserve(tl.size());
   for (size_t i = 0; i < tl.size(); ++i) {
     if (valid_mask[i]) filtered.push_back(tl[i]);
   }
-  logv("[DIAGNOSTIC] INVALID detected. Evaluating score on valid subset only: " +
+  if (verbose) logv("[DIAGNOSTIC] INVALID detected. Evaluating score on valid subset only: " +
        std::to_string(filtered.size()) + " / " + std::to_string(tl.size()) + " items.");
 }
 
  
-EvalOutput eval = any_invalid
-  ? evaluate(ins, filtered, verbose)
-  : evaluate(ins, tl,       verbose);
+const Timeline& scored = any_invalid ? filtered : tl;
+if (opts.on_phase) opts.on_phase("evaluate");
+// Catches a limit that passed after the last rule's final poll.
+if (stop.check()) return stopped("evaluate");
+EvalOutput eval;
+{
+  TraceSpan span("evaluate");
+  eval = (opts.pool && !verbose)
+    ? evaluate_parallel(ins, scored, *opts.pool, 0, arena, &stop)
+    : evaluate(ins, scored, verbose, arena, &stop);
+}
+if (eval.interrupted) return stopped("evaluate");
+if (opts.coefficients) {
+  TraceSpan span("coefficients");
+  *opts.coefficients = score_coefficients(ins, scored, arena);
+}
+if (opts.marginals) {
+  TraceSpan span("marginals");
+  std::vector<int> deltas = marginal_deltas(ins, scored, arena);
+  result.marginal.assign(tl.size(), 0);
+  for (size_t i = 0, k = 0; i < tl.size(); ++i)
+    if (valid_mask[i]) result.marginal[i] = deltas[k++];
+}
 
 result.status     = any_invalid ? "INVALID" : "VALID";
 result.violations = std::move(all_violations);
-result.timeline = tl;
+result.timeline.assign(tl.begin(), tl.end());
+result.valid.assign(valid_mask.begin(), valid_mask.end());
 result.score.base     = eval.base;
 result.score.bonuses  = eval.bonuses;
 result.score.switches.count = eval.switches;
@@ -403,318 +866,37 @@ return result;
 
 }
 
-bool validateInputStructure(const nlohmann::json& input) {
-    std::vector<std::string> required_fields = {
-        "opening_time", "closing_time", "min_duration", "max_consecutive_genre", 
-        "channels_count", "switch_penalty", "termination_penalty", "priority_blocks", 
-        "time_preferences", "channels"
-    };
-
-    for (const auto& field : required_fields) {
-        if (input.find(field) == input.end()) {
-            std::cout << "Error: Missing required field " << field << " in input file." << std::endl;
-            return false;
-        }
-    }
-    return true;
-}
-
-bool validateOpeningAndClosingTime(const nlohmann::json& input) {
-    int opening_time = input["opening_time"];
-    int closing_time = input["closing_time"];
-    
-    if (opening_time >= closing_time) {
-        std::cout << "Error: Opening time cannot be greater than or equal to closing time." << std::endl;
-        return false;
-    }
-    return true;
-}
-
-bool validateChannelsCount(const nlohmann::json& input) {
-    int channels_count = input["channels_count"];
-    int actual_channels_count = input["channels"].size();
-    
-    if (channels_count != actual_channels_count) {
-        std::cout << "Error: Channels count mismatch. Expected " << channels_count << ", but found " << actual_channels_count << "." << std::endl;
-        return false;
-    }
-    return true;
-}
-
-bool validatePriorityBlocks(const nlohmann::json& input) {
-    int opening_time = input["opening_time"];
-    int closing_time = input["closing_time"];
-    const nlohmann::json& priority_blocks = input["priority_blocks"];
-    
-    for (const auto& block : priority_blocks) {
-        int start = block["start"];
-        int end = block["end"];
-        const nlohmann::json& allowed_channels = block["allowed_channels"];
-        
-        if (start < opening_time || end > closing_time) {
-            std::cout << "Error: Priority block " << start << "-" << end << " is out of valid time range [" << opening_time << ", " << closing_time << "]." << std::endl;
-            return false;
-        }
-
-        for (const auto& channel_id : allowed_channels) {
-            if (channel_id < 0 || channel_id >= input["channels_count"]) {
-                std::cout << "Error: Invalid channel " << channel_id << " in priority block." << std::endl;
-                return false;
-            }
-        }
-    }
-    return true;
-}
-
-bool validateTimePreferences(const nlohmann::json& input) {
-    int opening_time = input["opening_time"];
-    int closing_time = input["closing_time"];
-    const nlohmann::json& time_preferences = input["time_preferences"];
-    
-    for (const auto& preference : time_preferences) {
-        int start = preference["start"];
-        int end = preference["end"];
-        std::string preferred_genre = preference["preferred_genre"];
-        
-        if (start < opening_time || end > closing_time) {
-            std::cout << "Error: Time preference " << start << "-" << end << " is out of valid time range [" << opening_time << ", " << closing_time << "]." << std::endl;
-            return false;
-        }
-
-
-        if (preferred_genre.empty()) {
-            std::cout << "Error: Preferred genre is empty or invalid." << std::endl;
-            return false;
-        }
-    }
-    return true;
-}
-
-bool validatePrograms(const nlohmann::json& input) {
-    int opening_time = input["opening_time"];
-    int closing_time = input["closing_time"];
-    const nlohmann::json& channels = input["channels"];
-    
-    for (const auto& channel : channels) {
-        const nlohmann::json& programs = channel["programs"];
-        
-        for (const auto& program : programs) {
-            int start = program["start"];
-            int end = program["end"];
-            
-            if (start < opening_time || end > closing_time || start >= end) {
-                std::cout << "Error: Program " << program["program_id"] << " has invalid start or end time." << std::endl;
-                return false;
-            }
-        }
-    }
-    return true;
-}
-
-
-bool validateProgramOverlapInInput(const nlohmann::json& input) {
-    for (const auto& channel : input["channels"]) {
-        const nlohmann::json& programs = channel["programs"];
-        
-
-        for (size_t i = 0; i < programs.size(); ++i) {
-            int start_i = programs[i]["start"];
-            int end_i = programs[i]["end"];
-            
-            for (size_t j = i + 1; j < programs.size(); ++j) {
-                int start_j = programs[j]["start"];
-                int end_j = programs[j]["end"];
-                
-
-                if ((start_i < end_j) && (end_i > start_j)) {
-                    std::cout << "Error: Programs in channel " << channel["channel_id"] << " overlap. Programs " 
-                              << programs[i]["program_id"] << " and " << programs[j]["program_id"] << " overlap." << std::endl;
-                    return false;
-                }
-            }
-        }
-    }
-    return true;
-}
-
-bool validateOutputStructure(const nlohmann::json& output) {
-    if (output.find("scheduled_programs") == output.end()) {
-        std::cout << "Error: Missing 'scheduled_programs' in output file." << std::endl;
-        return false;
-    }
-    if (!output["scheduled_programs"].is_array()) {
-        std::cout << "Error: 'scheduled_programs' should be an array." << std::endl;
-        return false;
-    }
-    return true;
-}
-
-
-bool validateNumPrograms(const nlohmann::json& output) {
-    if (output.find("num_programs") == output.end()) {
-        std::cout << "Error: Missing 'num_programs' in output file." << std::endl;
-        return false;
-    }
-
-    size_t num_programs_output = output["scheduled_programs"].size();
-    int num_programs = output["num_programs"];
-
-    if (num_programs != num_programs_output) {
-        std::cout << "Error: 'num_programs' in output file does not match the number of scheduled programs." << std::endl;
-        return false;
-    }
-
-    return true;
-}
-
-bool validateProgramTimes(const nlohmann::json& output, int opening_time, int closing_time) {
-    const nlohmann::json& scheduled_programs = output["scheduled_programs"];
-    
-    for (const auto& program : scheduled_programs) {
-        int start = program["start"];
-        int end = program["end"];
-        
-        if (start < opening_time || end > closing_time) {
-            std::cout << "Error: Program " << program["program_id"] << " has invalid start or end time." << std::endl;
-            return false;
-        }
-    }
-    return true;
-}
-
-bool validateProgramOverlap(const nlohmann::json& output) {
-    std::unordered_map<int, std::vector<std::pair<int, int>>> channel_times;
-    const nlohmann::json& scheduled_programs = output["scheduled_programs"];
-    
-    for (const auto& program : scheduled_programs) {
-        int channel_id = program["channel_id"];
-        int start = program["start"];
-        int end = program["end"];
-        
-        for (const auto& existing_program : channel_times[channel_id]) {
-            if ((start < existing_program.second) && (end > existing_program.first)) {
-                std::cout << "Error: Overlap detected in channel " << channel_id << " between programs." << std::endl;
-                return false;
-            }
-        }
-        
-        channel_times[channel_id].push_back({start, end});
-    }
-    
-    return true;
-}
-
-bool validateProgramsExistInInput(const nlohmann::json& input, const nlohmann::json& output) {
-    std::unordered_map<std::string, bool> input_programs;
-    for (const auto& channel : input["channels"]) {
-        for (const auto& program : channel["programs"]) {
-            input_programs[program["program_id"]] = true;
-        }
-    }
-
-    for (const auto& scheduled_program : output["scheduled_programs"]) {
-        std::string program_id = scheduled_program["program_id"];
-        
-        if (input_programs.find(program_id) == input_programs.end()) {
-            std::cout << "Error: Program " << program_id << " in output file does not exist in input file." << std::endl;
-            return false;
-        }
-    }
-    return true;
-}
-
-bool validateProgramAndChannel(const nlohmann::json& output, const nlohmann::json& input) {
-    const nlohmann::json& scheduled_programs = output["scheduled_programs"];
-
-    for (const auto& program : scheduled_programs) {
-        int channel_id = program["channel_id"];
-        std::string program_id = program["program_id"];
-
-        auto channel_it = std::find_if(input["channels"].begin(), input["channels"].end(),
-            [channel_id](const nlohmann::json& channel) {
-                return channel["channel_id"] == channel_id;
-            });
-
-        if (channel_it == input["channels"].end()) {
-            std::cout << "Error: Channel ID " << channel_id << " in output file does not exist in input file." << std::endl;
-            return false;
-        }
-
-        bool program_found = false;
-        for (const auto& p : channel_it->at("programs")) {
-            if (p["program_id"] == program_id) {
-                program_found = true;
-                break;
-            }
-        }
-
-        if (!program_found) {
-            std::cout << "Error: Program ID " << program_id << " does not belong to Channel " << channel_id << " in input file." << std::endl;
-            return false;
-        }
-        
-        auto program_in_output = std::find_if(scheduled_programs.begin(), scheduled_programs.end(),
-            [program_id](const nlohmann::json& p) {
-                return p["program_id"] == program_id;
-            });
-
-        if (program_in_output != scheduled_programs.end()) {
-            int output_channel = program_in_output->at("channel_id");
-            if (output_channel != channel_id) {
-                std::cout << "Error: Program ID " << program_id << " is scheduled in channel " 
-                          << output_channel << " in output file, but it should be in channel " 
-                          << channel_id << " based on the input file." << std::endl;
-                return false;
-            }
-        }
-    }
-
-    return true;
-}
-
-static void collectInputOverlapsAsViolations(const nlohmann::json& input,
-                                             std::vector<Violation>& out,
-                                             std::function<void(const std::string&)> logv,
-                                             std::unordered_set<std::string>& overlapped_prog_ids) {  // <- SHTUAR
-  for (const auto& channel : input["channels"]) {
-    int ch = channel["channel_id"];
-    const auto& programs = channel["programs"];
-
-    struct Seg { int s,e; std::string id; };
-    std::vector<Seg> segs;
-    segs.reserve(programs.size());
-    for (const auto& p : programs) {
-      segs.push_back(Seg{ p["start"], p["end"], p["program_id"] });
-    }
-    std::sort(segs.begin(), segs.end(), [](const Seg& a, const Seg& b){
-      if (a.s != b.s) return a.s < b.s;
-      if (a.e != b.e) return a.e < b.e;
-      return a.id < b.id;
-    });
-
-    std::vector<size_t> active;
-    for (size_t i = 0; i < segs.size(); ++i) {
-      const auto& C = segs[i];
-      size_t w = 0;
-      for (size_t r = 0; r < active.size(); ++r) {
-        const auto& A = segs[active[r]];
-        if (A.e > C.s) active[w++] = active[r];
-      }
-      active.resize(w);
-
-      for (size_t r = 0; r < active.size(); ++r) {
-        const auto& A = segs[active[r]];
-        if ((C.s < A.e) && (C.e > A.s)) {
-
-        overlapped_prog_ids.insert(A.id);
-        overlapped_prog_ids.insert(C.id);
-
-
-        logv("[WARN] INPUT_OVERLAP in input ch=" + std::to_string(ch) + " " + A.id + " <-> " + C.id);
-      }
-
-      }
-      active.push_back(i);
+static void collectInputOverlaps(const Instance& ins,
+                                 std::pmr::vector<PreparedInstance::InputOverlap>& out,
+                                 std::pmr::unordered_set<std::string_view>& overlapped_prog_ids,
+                                 std::pmr::memory_resource* scratch,
+                                 ThreadPool* pool) {  // <- SHTUAR
+  using Pair = std::pair<const Program*, const Program*>;
+  const size_t nch = ins.channels.size();
+
+  // Channels are independent: sweep them on the pool into per-channel lists,
+  // then merge in channel order so logs and the id set come out the same.
+  // The scratch arena is single-threaded, so workers use the heap.
+  const bool parallel = pool && nch > 1;
+  std::pmr::vector<std::pmr::vector<Pair>> pairs(
+    nch, parallel ? std::pmr::new_delete_resource() : scratch);
+
+  auto sweep_channel = [&](size_t c) {
+    const auto& progs = ins.channels[c].programs;
+    std::pmr::memory_resource* mem = pairs[c].get_allocator().resource();
+    sweep_overlaps(progs.size(),
+      [&](size_t i){ return std::make_tuple(progs[i].start, progs[i].end, &progs[i].id); },
+      [&](size_t a, size_t i){ pairs[c].emplace_back(&progs[a], &progs[i]); return true; },
+      mem);
+  };
+  if (parallel) pool->parallel_for(nch, sweep_channel);
+  else for (size_t c = 0; c < nch; ++c) sweep_channel(c);
+
+  for (size_t c = 0; c < nch; ++c) {
+    for (const auto& [A, C] : pairs[c]) {
+      overlapped_prog_ids.insert(A->id);
+      overlapped_prog_ids.insert(C->id);
+      out.push_back({ins.channels[c].id, A, C});
     }
   }
 }
@@ -1,21 +1,38 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-em++ -O3 \
+# The core reports errors by value, so by default the module is built with
+# -fno-exceptions: no landing pads or EH runtime. TVV_WASM_EXCEPTIONS=1
+# builds with exception catching instead, for comparing size and speed.
+if [ "${TVV_WASM_EXCEPTIONS:-0}" = 1 ]; then
+  EH_FLAGS=(-s DISABLE_EXCEPTION_CATCHING=0)
+else
+  EH_FLAGS=(-fno-exceptions)
+fi
+
+# The browser has nowhere to write a trace: TVV_NO_TRACE compiles the spans out.
+em++ -O3 "${EH_FLAGS[@]}" -DTVV_NO_TRACE \
   -s MODULARIZE=1 \
   -s EXPORT_NAME='createValidatorModule' \
   -s ENVIRONMENT=web \
-  -s DISABLE_EXCEPTION_CATCHING=0 \
   -s ALLOW_MEMORY_GROWTH=1 \
+  -s ALLOW_TABLE_GROWTH=1 \
   -s INITIAL_MEMORY=268435456 \
   -s MAXIMUM_MEMORY=1073741824 \
   -s STACK_SIZE=16777216 \
-  -s EXPORTED_FUNCTIONS='["_validate_json","_free_buffer","_malloc","_free"]' \
-  -s EXPORTED_RUNTIME_METHODS='["cwrap","getValue","UTF8ToString","lengthBytesUTF8","stringToUTF8"]' \
+  -s EXPORTED_FUNCTIONS='["_validate_json","_free_buffer","_validate_buffers","_validate_binary","_free_result","_validate_streaming","_set_time_budget","_set_all_errors","_malloc","_free","_tvv_instance_load","_tvv_instance_free","_tvv_instance_error","_tvv_instance_program_count","_tvv_instance_program_ordinal","_tvv_instance_program_id","_tvv_validate_items","_tvv_result_violation_count","_tvv_result_violation","_tvv_result_error","_tvv_result_free"]' \
+  -s EXPORTED_RUNTIME_METHODS='["cwrap","getValue","UTF8ToString","lengthBytesUTF8","stringToUTF8","HEAPU8","addFunction","removeFunction"]' \
   -I ../validator/inc \
   ../validator/src/mapping.cc \
   ../validator/src/validator.cc \
   ../validator/src/rules.cc \
+  ../validator/src/schema.cc \
+  ../validator/src/scratch.cc \
+  ../validator/src/thread_pool.cc \
+  ../validator/src/result_cache.cc \
+  ../validator/src/stream.cc \
+  ../validator/src/capi.cc \
+  ../validator/src/trace.cc \
   -o validator.js
 
 mkdir -p ../public/wasm